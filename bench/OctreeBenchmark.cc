@@ -0,0 +1,956 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "BoxFilter.h"
+#include "CompressedModel.h"
+#include "Model.h"
+#include "OBJLoader.h"
+#include "Octree.h"
+#include "OctreeCompressor.h"
+#include "Parallel.h"
+#include "PointCloudCodec.h"
+#include "StreamCodec.h"
+#include "VertexData.h"
+
+// Node layout the octree used before the arena storage: one heap allocation
+// per node, children owned through unique_ptr. Kept here as the baseline the
+// arena build is measured against.
+template <typename T>
+class PointerOctree {
+   public:
+    struct Node {
+        glm::vec3 center;
+        float halfSize;
+        std::vector<T> data;
+        std::array<std::unique_ptr<Node>, 8> children;
+
+        bool isLeaf() const { return !children[0]; }
+    };
+
+    PointerOctree(const glm::vec3& center, float halfSize, int maxDepth)
+        : maxDepth(maxDepth) {
+        root = std::make_unique<Node>();
+        root->center = center;
+        root->halfSize = halfSize;
+    }
+
+    void insert(const T& item, const glm::vec3& position) {
+        insertHelper(root.get(), item, position, 0);
+    }
+
+    std::vector<T> query(const glm::vec3& min, const glm::vec3& max) const {
+        std::vector<T> results;
+        queryHelper(root.get(), min, max, results);
+        return results;
+    }
+
+   private:
+    std::unique_ptr<Node> root;
+    int maxDepth;
+
+    void insertHelper(Node* node, const T& item, const glm::vec3& position,
+                      int depth) {
+        glm::vec3 diff = glm::abs(position - node->center);
+        if (diff.x > node->halfSize || diff.y > node->halfSize ||
+            diff.z > node->halfSize) {
+            return;
+        }
+        if (depth >= maxDepth || (node->isLeaf() && node->data.size() < 8)) {
+            node->data.push_back(item);
+            return;
+        }
+        if (node->isLeaf()) {
+            float newHalfSize = node->halfSize * 0.5f;
+            for (int i = 0; i < 8; ++i) {
+                node->children[i] = std::make_unique<Node>();
+                node->children[i]->halfSize = newHalfSize;
+                glm::vec3 offset;
+                offset.x = ((i & 1) ? 1 : -1) * newHalfSize;
+                offset.y = ((i & 2) ? 1 : -1) * newHalfSize;
+                offset.z = ((i & 4) ? 1 : -1) * newHalfSize;
+                node->children[i]->center = node->center + offset;
+            }
+            std::vector<T> oldData = std::move(node->data);
+            node->data.clear();
+            for (const auto& oldItem : oldData) {
+                insertHelper(node, oldItem, oldItem.position, depth);
+            }
+        }
+        int octant = 0;
+        if (position.x > node->center.x) octant |= 1;
+        if (position.y > node->center.y) octant |= 2;
+        if (position.z > node->center.z) octant |= 4;
+        insertHelper(node->children[octant].get(), item, position, depth + 1);
+    }
+
+    void queryHelper(const Node* node, const glm::vec3& min,
+                     const glm::vec3& max, std::vector<T>& results) const {
+        glm::vec3 nodeMin = node->center - glm::vec3(node->halfSize);
+        glm::vec3 nodeMax = node->center + glm::vec3(node->halfSize);
+        if (min.x > nodeMax.x || max.x < nodeMin.x || min.y > nodeMax.y ||
+            max.y < nodeMin.y || min.z > nodeMax.z || max.z < nodeMin.z) {
+            return;
+        }
+        for (const auto& item : node->data) {
+            if (item.position.x >= min.x && item.position.x <= max.x &&
+                item.position.y >= min.y && item.position.y <= max.y &&
+                item.position.z >= min.z && item.position.z <= max.z) {
+                results.push_back(item);
+            }
+        }
+        if (!node->isLeaf()) {
+            for (const auto& child : node->children) {
+                queryHelper(child.get(), min, max, results);
+            }
+        }
+    }
+};
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+// Fastest of `runs` calls of run, in milliseconds. Short runs vary with
+// what else the machine is doing by more than the differences measured.
+template <typename Run>
+double bestMs(int runs, Run&& run) {
+    double best = 0.0;
+    for (int i = 0; i < runs; ++i) {
+        auto start = Clock::now();
+        run();
+        double ms = elapsedMs(start);
+        if (i == 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+// Resident set size in bytes, read from /proc. Returns 0 where unavailable.
+size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) return 0;
+    return resident * 4096;
+}
+
+// Hand freed heap pages back to the OS so the next measurement starts clean.
+void releaseFreedMemory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+double toMiB(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+// Noisy sphere shell, the closest synthetic stand-in for a surface scan.
+std::unique_ptr<Model> makeSyntheticModel(size_t count) {
+    auto model = std::make_unique<Model>();
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    model->vertices.reserve(count);
+    model->colors.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec3 dir(gauss(rng), gauss(rng), gauss(rng));
+        dir = dir / std::max(glm::length(dir), 1e-6f);
+        float radius = 1.0f + 0.01f * gauss(rng);
+        model->vertices.push_back(dir * radius);
+        // Smooth shading with a little sensor noise, like a scanned surface
+        glm::vec3 noise(unit(rng), unit(rng), unit(rng));
+        model->colors.push_back(glm::clamp(
+            glm::vec3(0.5f) + 0.4f * dir + 0.05f * (noise - 0.5f),
+            glm::vec3(0.0f), glm::vec3(1.0f)));
+    }
+    model->calculateBounds();
+    return model;
+}
+
+struct Cube {
+    glm::vec3 center;
+    float halfSize;
+};
+
+// Same root cube OctreeCompressor derives from the model bounds.
+Cube rootCube(const Model& model) {
+    glm::vec3 extent = model.maxBounds - model.minBounds;
+    float maxExtent = std::max({extent.x, extent.y, extent.z});
+    return {(model.minBounds + model.maxBounds) * 0.5f,
+            maxExtent * 0.5f * 1.1f};
+}
+
+template <typename Tree>
+void fill(Tree& tree, const Model& model) {
+    for (size_t i = 0; i < model.vertices.size(); ++i) {
+        tree.insert(VertexData(model.vertices[i], model.colors[i]),
+                    model.vertices[i]);
+    }
+}
+
+template <typename Tree>
+void measureBuild(const char* label, const Model& model, int maxDepth) {
+    releaseFreedMemory();
+    size_t rssBefore = residentBytes();
+    Cube cube = rootCube(model);
+
+    auto start = Clock::now();
+    auto tree = std::make_unique<Tree>(cube.center, cube.halfSize, maxDepth);
+    fill(*tree, model);
+    double buildMs = elapsedMs(start);
+    releaseFreedMemory();
+    size_t rssAfter = residentBytes();
+
+    start = Clock::now();
+    size_t found = tree->query(model.minBounds, model.maxBounds).size();
+    double queryMs = elapsedMs(start);
+
+    std::cout << "  " << std::left << std::setw(10) << label << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << buildMs << " ms build" << std::setw(10) << queryMs
+              << " ms query" << std::setw(10)
+              << toMiB(rssAfter > rssBefore ? rssAfter - rssBefore : 0)
+              << " MiB resident  (" << found << " points)\n";
+}
+
+void benchStorage(const Model& model) {
+    std::cout << "node storage, maxDepth 8\n";
+    measureBuild<PointerOctree<VertexData>>("pointer", model, 8);
+    measureBuild<Octree<VertexData>>("arena", model, 8);
+}
+
+std::string serialize(const Octree<VertexData>& tree) {
+    std::ostringstream out(std::ios::binary);
+    tree.write(out);
+    return out.str();
+}
+
+void benchBulkBuild(const Model& model) {
+    std::cout << "construction, maxDepth 8\n";
+    Cube cube = rootCube(model);
+    auto makeItem = [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    };
+
+    auto start = Clock::now();
+    Octree<VertexData> incremental(cube.center, cube.halfSize, 8);
+    fill(incremental, model);
+    double incrementalMs = elapsedMs(start);
+
+    start = Clock::now();
+    Octree<VertexData> bulk(cube.center, cube.halfSize, 8);
+    bulk.build(model.vertices, makeItem);
+    double bulkMs = elapsedMs(start);
+
+    // Streaming ingest: the points arrive in chunks of 64k
+    start = Clock::now();
+    Octree<VertexData> batched(cube.center, cube.halfSize, 8);
+    const size_t chunk = size_t(1) << 16;
+    for (size_t first = 0; first < model.vertices.size(); first += chunk) {
+        size_t count = std::min(chunk, model.vertices.size() - first);
+        batched.insertBatch(&model.vertices[first], count,
+                            [&](size_t i) { return makeItem(first + i); });
+    }
+    double batchedMs = elapsedMs(start);
+
+    // At least two threads, so that the partitioned build is the one
+    // compared below even on a single core
+    unsigned threads = std::max(resolveThreadCount(0), 2u);
+    start = Clock::now();
+    Octree<VertexData> parallel(cube.center, cube.halfSize, 8);
+    parallel.build(model.vertices, makeItem, threads);
+    double parallelMs = elapsedMs(start);
+
+    std::cout << std::fixed << std::setprecision(1) << "  incremental "
+              << std::setw(10) << incrementalMs << " ms  ("
+              << incremental.getNodeCount() << " nodes)\n"
+              << "  batched     " << std::setw(10) << batchedMs << " ms  ("
+              << batched.getNodeCount() << " nodes)\n"
+              << "  morton bulk " << std::setw(10) << bulkMs << " ms  ("
+              << bulk.getNodeCount() << " nodes)\n"
+              << "  parallel    " << std::setw(10) << parallelMs << " ms  ("
+              << parallel.getNodeCount() << " nodes, " << threads
+              << " threads)\n";
+
+    // Every construction path promises the tree inserting the points one
+    // by one builds, so their serialized sections must match byte for byte.
+    const std::string expected = serialize(incremental);
+    const std::pair<const char*, const Octree<VertexData>*> others[] = {
+        {"batched", &batched}, {"morton bulk", &bulk}, {"parallel", &parallel}};
+    for (const auto& [label, tree] : others) {
+        if (serialize(*tree) != expected) {
+            std::cerr << "FAILED: the " << label
+                      << " build differs from the incremental one\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    std::cout << "  all four builds write identical sections\n";
+}
+
+// Moving and removing a tenth of the points in place against rebuilding.
+void benchUpdates(const Model& model) {
+    std::cout << "in-place updates of 10% of the points, maxDepth 8\n";
+    Cube cube = rootCube(model);
+    auto makeItem = [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    };
+    Octree<VertexData> tree(cube.center, cube.halfSize, 8);
+    tree.build(model.vertices, makeItem);
+
+    auto start = Clock::now();
+    Octree<VertexData> rebuilt(cube.center, cube.halfSize, 8);
+    rebuilt.build(model.vertices, makeItem);
+    double rebuildMs = elapsedMs(start);
+
+    // Small moves, as between scans, kept inside the root
+    std::vector<glm::vec3> positions = model.vertices;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+    const size_t updates = positions.size() / 10;
+    const size_t stride = 10;
+    start = Clock::now();
+    size_t moved = 0;
+    for (size_t i = 0; i < positions.size(); i += stride) {
+        glm::vec3 to = glm::clamp(
+            positions[i] +
+                glm::vec3(jitter(rng), jitter(rng), jitter(rng)) *
+                    cube.halfSize,
+            model.minBounds, model.maxBounds);
+        if (tree.move(positions[i], to)) {
+            positions[i] = to;
+            ++moved;
+        }
+    }
+    double moveMs = elapsedMs(start);
+
+    start = Clock::now();
+    size_t removed = 0;
+    for (size_t i = 0; i < positions.size(); i += stride) {
+        removed += tree.remove(positions[i]) ? 1 : 0;
+    }
+    double removeMs = elapsedMs(start);
+
+    std::cout << std::fixed << std::setprecision(1) << "  rebuild     "
+              << std::setw(10) << rebuildMs << " ms\n"
+              << "  move        " << std::setw(10) << moveMs << " ms  ("
+              << moved << " of " << updates << ")\n"
+              << "  remove      " << std::setw(10) << removeMs << " ms  ("
+              << removed << " of " << updates << ", "
+              << tree.getNodeCount() << " nodes left)\n";
+}
+
+// Full-bounds query through each of the query entry points.
+void benchQueryApi(const Model& model) {
+    std::cout << "full-bounds query API\n";
+    Cube cube = rootCube(model);
+    Octree<VertexData> tree(cube.center, cube.halfSize, 8);
+    tree.build(model.vertices, [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    });
+
+    auto start = Clock::now();
+    size_t copied = tree.query(model.minBounds, model.maxBounds).size();
+    double copyMs = elapsedMs(start);
+
+    start = Clock::now();
+    glm::vec3 sum(0.0f);
+    tree.queryEach(model.minBounds, model.maxBounds,
+                   [&](const glm::vec3& color, const glm::vec3&) {
+                       sum += color;
+                   });
+    double visitMs = elapsedMs(start);
+
+    start = Clock::now();
+    size_t counted = tree.queryCount(model.minBounds, model.maxBounds);
+    double countMs = elapsedMs(start);
+
+    // What the traversal cost before whole-node acceptance: every item of
+    // every intersected node tested one by one.
+    start = Clock::now();
+    size_t tested = 0;
+    tree.queryBuckets(model.minBounds, model.maxBounds,
+                      [&](const glm::vec3*, const glm::vec3* positions,
+                          size_t count, bool) {
+                          for (size_t i = 0; i < count; ++i) {
+                              tested += inBox(positions[i], model.minBounds,
+                                              model.maxBounds);
+                          }
+                      });
+    double perPointMs = elapsedMs(start);
+
+    std::cout << std::fixed << std::setprecision(1) << "  query (copy) "
+              << std::setw(10) << copyMs << " ms  (" << copied << ")\n"
+              << "  queryEach    " << std::setw(10) << visitMs << " ms\n"
+              << "  queryCount   " << std::setw(10) << countMs << " ms  ("
+              << counted << ")\n"
+              << "  per-point    " << std::setw(10) << perPointMs << " ms  ("
+              << tested << ")\n";
+}
+
+// Windows covering a growing share of the root cube, counted with and
+// without whole-node acceptance and the SIMD point filter.
+void benchWindowQueries(const Model& model) {
+    std::cout << "window queries around the first point (fraction of root "
+                 "edge)\n";
+    Cube cube = rootCube(model);
+    Octree<VertexData> tree(cube.center, cube.halfSize, 8);
+    tree.build(model.vertices, [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    });
+
+    for (float fraction : {0.05f, 0.25f, 0.5f, 1.0f}) {
+        glm::vec3 half(cube.halfSize * fraction);
+        glm::vec3 min = model.vertices[0] - half;
+        glm::vec3 max = model.vertices[0] + half;
+
+        auto start = Clock::now();
+        size_t fast = 0;
+        for (int rep = 0; rep < 10; ++rep) fast += tree.queryCount(min, max);
+        double fastMs = elapsedMs(start) / 10;
+
+        start = Clock::now();
+        size_t slow = 0;
+        for (int rep = 0; rep < 10; ++rep) {
+            tree.queryBuckets(min, max,
+                              [&](const glm::vec3*,
+                                  const glm::vec3* positions, size_t count,
+                                  bool) {
+                                  for (size_t i = 0; i < count; ++i) {
+                                      slow += inBox(positions[i], min, max);
+                                  }
+                              });
+        }
+        double slowMs = elapsedMs(start) / 10;
+
+        std::cout << std::fixed << std::setprecision(2) << std::setw(8)
+                  << fraction << std::setprecision(1) << std::setw(10)
+                  << slowMs << " ms per-point" << std::setw(10) << fastMs
+                  << " ms fast path  (" << fast / 10 << " points"
+                  << (fast == slow ? "" : ", MISMATCH") << ")\n";
+    }
+}
+
+// Octree neighbour searches against a linear scan over all points.
+void benchNeighbors(const Model& model) {
+    const size_t k = 16;
+    const size_t queryCount = 1000;
+    std::cout << "neighbour search, " << queryCount << " queries, k = " << k
+              << "\n";
+
+    Cube cube = rootCube(model);
+    Octree<VertexData> tree(cube.center, cube.halfSize, 8);
+    tree.build(model.vertices, [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    });
+
+    std::vector<glm::vec3> queries;
+    size_t stride = std::max<size_t>(model.vertices.size() / queryCount, 1);
+    for (size_t i = 0; i < model.vertices.size() && queries.size() < queryCount;
+         i += stride) {
+        queries.push_back(model.vertices[i]);
+    }
+
+    std::vector<Octree<VertexData>::Neighbor> neighbors;
+    std::vector<uint32_t> counts;
+    auto start = Clock::now();
+    tree.nearestBatch(queries, k, neighbors, counts, 1);
+    double knnMs = elapsedMs(start);
+
+    unsigned threads = resolveThreadCount(0);
+    start = Clock::now();
+    tree.nearestBatch(queries, k, neighbors, counts, threads);
+    double knnParallelMs = elapsedMs(start);
+
+    // Search radius: the mean k-th neighbour distance
+    float radius = 0.0f;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        radius += std::sqrt(neighbors[i * k + counts[i] - 1].distanceSquared);
+    }
+    radius /= static_cast<float>(queries.size());
+
+    start = Clock::now();
+    size_t radiusHits = 0;
+    std::vector<Octree<VertexData>::Neighbor> inRadius;
+    for (const auto& query : queries) {
+        tree.queryRadius(query, radius, inRadius);
+        radiusHits += inRadius.size();
+    }
+    double radiusMs = elapsedMs(start);
+
+    // Brute force on a tenth of the queries, scaled up
+    size_t bruteQueries = std::max<size_t>(queries.size() / 10, 1);
+    std::vector<float> distances(model.vertices.size());
+    start = Clock::now();
+    size_t bruteHits = 0;
+    for (size_t q = 0; q < bruteQueries; ++q) {
+        for (size_t i = 0; i < model.vertices.size(); ++i) {
+            glm::vec3 diff = model.vertices[i] - queries[q];
+            distances[i] = glm::dot(diff, diff);
+            bruteHits += distances[i] <= radius * radius;
+        }
+        std::nth_element(distances.begin(), distances.begin() + (k - 1),
+                         distances.end());
+    }
+    double bruteMs =
+        elapsedMs(start) * queries.size() / static_cast<double>(bruteQueries);
+
+    std::cout << std::fixed << std::setprecision(1) << "  kNN          "
+              << std::setw(10) << knnMs << " ms\n"
+              << "  kNN batch    " << std::setw(10) << knnParallelMs
+              << " ms  (" << threads << " threads)\n"
+              << "  radius       " << std::setw(10) << radiusMs << " ms  (r = "
+              << std::setprecision(4) << radius << ", "
+              << radiusHits / queries.size() << " hits/query)\n"
+              << std::setprecision(1) << "  brute force  " << std::setw(10)
+              << bruteMs << " ms  (kNN + radius, extrapolated, "
+              << bruteHits / bruteQueries << " hits/query)\n";
+}
+
+// Cold start from a saved model versus compressing from scratch.
+void benchPersistence(const Model& model) {
+    std::cout << "save / load\n";
+    std::string path =
+        (std::filesystem::temp_directory_path() / "octree_bench.octc")
+            .string();
+
+    OctreeCompressor compressor;
+    auto start = Clock::now();
+    auto compressed = compressor.compress(model);
+    double compressMs = elapsedMs(start);
+
+    start = Clock::now();
+    compressed->save(path);
+    double saveMs = elapsedMs(start);
+    size_t fileSize = std::filesystem::file_size(path);
+
+    start = Clock::now();
+    auto loaded = CompressedModel::load(path);
+    double loadMs = elapsedMs(start);
+
+    start = Clock::now();
+    auto mapped = CompressedModel::map(path);
+    double mapMs = elapsedMs(start);
+
+    start = Clock::now();
+    size_t decoded = mapped->decompress()->vertices.size();
+    double mappedDecompressMs = elapsedMs(start);
+    mapped.reset();
+    std::filesystem::remove(path);
+
+    std::cout << std::fixed << std::setprecision(1) << "  compress     "
+              << std::setw(10) << compressMs << " ms\n"
+              << "  save         " << std::setw(10) << saveMs << " ms  ("
+              << toMiB(fileSize) << " MiB)\n"
+              << "  load         " << std::setw(10) << loadMs << " ms  ("
+              << loaded->getVertexCount() << " points)\n"
+              << "  map          " << std::setw(10) << mapMs << " ms\n"
+              << "  decompress   " << std::setw(10) << mappedDecompressMs
+              << " ms  (mapped, " << decoded << " points)\n";
+}
+
+// Encoded size and encode / decode time at several grid depths, with the
+// decode rate of the positions alone. Decodes are timed best of five.
+void benchCodec(const Model& model) {
+    std::cout << "encoded stream (PointCloudCodec)\n";
+    Cube cube = rootCube(model);
+    const double points = static_cast<double>(model.vertices.size());
+    const double rawBytes = points * sizeof(VertexData);
+
+    for (int depth : {8, 10, 12}) {
+        auto start = Clock::now();
+        auto stream =
+            PointCloudCodec::encode(model, cube.center, cube.halfSize, depth);
+        double encodeMs = elapsedMs(start);
+
+        std::unique_ptr<Model> decoded;
+        double decodeMs =
+            bestMs(5, [&] { decoded = PointCloudCodec::decode(stream); });
+        size_t positions = 0;
+        double positionsMs = bestMs(5, [&] {
+            positions =
+                PointCloudCodec::decodePositions(stream)->vertices.size();
+        });
+
+        // Decoded order differs from input order, so compare bounds only.
+        float cell = 2.0f * cube.halfSize / static_cast<float>(1u << depth);
+        glm::vec3 slack =
+            glm::max(glm::abs(decoded->minBounds - model.minBounds),
+                     glm::abs(decoded->maxBounds - model.maxBounds));
+
+        std::cout << std::fixed << std::setprecision(1) << "  depth "
+                  << std::setw(2) << depth << std::setw(10) << encodeMs
+                  << " ms encode" << std::setw(10) << decodeMs
+                  << " ms decode (" << std::setw(5)
+                  << points / decodeMs / 1000.0 << " Mpts/s)" << std::setw(8)
+                  << std::setprecision(2)
+                  << stream.size() * 8.0 / points << " bits/pt  ("
+                  << std::setprecision(1) << rawBytes / stream.size()
+                  << "x vs VertexData, bounds within "
+                  << std::setprecision(2)
+                  << std::max({slack.x, slack.y, slack.z}) / cell
+                  << " cells)\n"
+                  << std::setprecision(1) << std::setw(30) << positionsMs
+                  << " ms positions only (" << std::setw(5)
+                  << positions / positionsMs / 1000.0 << " Mpts/s)\n";
+    }
+}
+
+void benchStreamCodecs(const Model& model) {
+    std::cout << "stream codecs on RGB8 colors\n";
+    std::vector<uint8_t> colors;
+    colors.reserve(3 * model.colors.size());
+    for (const glm::vec3& color : model.colors) {
+        for (int c = 0; c < 3; ++c) {
+            colors.push_back(static_cast<uint8_t>(
+                std::lround(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f)));
+        }
+    }
+    const double mb = colors.size() / 1e6;
+
+    const std::pair<const char*, StreamCoding> codings[] = {
+        {"raw", StreamCoding::Raw},
+        {"rANS static", StreamCoding::RansStatic},
+        {"rANS adaptive", StreamCoding::RansAdaptive},
+    };
+    for (const auto& [label, coding] : codings) {
+        const StreamCodec& codec = StreamCodec::get(coding);
+        std::vector<uint8_t> coded;
+        auto start = Clock::now();
+        codec.encode(colors.data(), colors.size(), coded);
+        double encodeMs = elapsedMs(start);
+
+        start = Clock::now();
+        auto decoded = codec.decode(coded.data(), coded.size(), colors.size());
+        double decodeMs = elapsedMs(start);
+
+        std::cout << "  " << std::left << std::setw(14) << label << std::right
+                  << std::fixed << std::setprecision(0) << std::setw(8)
+                  << mb / encodeMs * 1000.0 << " MB/s encode" << std::setw(8)
+                  << mb / decodeMs * 1000.0 << " MB/s decode"
+                  << std::setprecision(2) << std::setw(8)
+                  << coded.size() * 8.0 / colors.size() << " bits/byte"
+                  << (decoded == colors ? "" : "  MISMATCH") << "\n";
+    }
+
+    // Whole-stream size with each part coded differently
+    Cube cube = rootCube(model);
+    PointCloudCodec::Options plain;
+    plain.contextOccupancy = false;
+    plain.occupancyCoding = plain.countCoding = plain.colorCoding =
+        StreamCoding::Raw;
+    plain.colorQuality = 100;
+    PointCloudCodec::Options ransOnly;
+    ransOnly.contextOccupancy = false;
+    ransOnly.colorQuality = 100;
+    const std::pair<const char*, PointCloudCodec::Options> modes[] = {
+        {"all raw", plain},
+        {"all rANS", ransOnly},
+        {"default", PointCloudCodec::Options()},
+    };
+    for (const auto& [label, options] : modes) {
+        auto stream = PointCloudCodec::encode(model, cube.center,
+                                              cube.halfSize, 10, options);
+        auto start = Clock::now();
+        PointCloudCodec::decode(stream);
+        double decodeMs = elapsedMs(start);
+        std::cout << "  " << std::left << std::setw(14) << label << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8)
+                  << stream.size() * 8.0 / model.vertices.size()
+                  << " bits/pt at depth 10" << std::setprecision(1)
+                  << std::setw(10) << decodeMs << " ms decode\n";
+    }
+}
+
+void benchColorQuality(const Model& model) {
+    std::cout << "RAHT color quality at depth 10 (PSNR against exact 8-bit "
+                 "colors)\n";
+    Cube cube = rootCube(model);
+    // Constant colors cost next to nothing, which leaves the geometry
+    Model flat;
+    flat.vertices = model.vertices;
+    flat.colors.assign(model.colors.size(), glm::vec3(0.5f));
+    PointCloudCodec::Options options;
+    options.colorQuality = 100;
+    auto exact = PointCloudCodec::decode(PointCloudCodec::encode(
+        model, cube.center, cube.halfSize, 10, options));
+
+    for (int quality : {100, 90, 75, 50, 25}) {
+        options.colorQuality = quality;
+        size_t geometry = PointCloudCodec::encode(flat, cube.center,
+                                                  cube.halfSize, 10, options)
+                              .size();
+        auto start = Clock::now();
+        auto stream = PointCloudCodec::encode(model, cube.center,
+                                              cube.halfSize, 10, options);
+        double encodeMs = elapsedMs(start);
+        start = Clock::now();
+        auto decoded = PointCloudCodec::decode(stream);
+        double decodeMs = elapsedMs(start);
+
+        double squared = 0.0;
+        for (size_t i = 0; i < decoded->colors.size(); ++i) {
+            glm::vec3 error = (decoded->colors[i] - exact->colors[i]) * 255.0f;
+            squared += glm::dot(error, error) / 3.0;
+        }
+        double mse = squared / std::max<size_t>(decoded->colors.size(), 1);
+        double psnr = 10.0 * std::log10(255.0 * 255.0 / std::max(mse, 1e-12));
+        double colorBits = (double(stream.size()) - double(geometry)) * 8.0 /
+                           model.vertices.size();
+
+        std::cout << "  quality " << std::setw(3) << quality << std::fixed
+                  << std::setprecision(2) << std::setw(8) << colorBits
+                  << " color bits/pt" << std::setprecision(1) << std::setw(8)
+                  << std::min(psnr, 99.0) << " dB" << std::setw(10)
+                  << encodeMs << " ms encode" << std::setw(10) << decodeMs
+                  << " ms decode\n";
+    }
+}
+
+void benchLevelOfDetail(const Model& model) {
+    std::cout << "progressive decode of a depth 12 stream\n"
+              << "  level      points   bytes read   decode ms\n";
+    Cube cube = rootCube(model);
+    // Default options: levels past the subtree level decode from a prefix
+    // too
+    auto stream =
+        PointCloudCodec::encode(model, cube.center, cube.halfSize, 12);
+    for (int level : {2, 4, 6, 8, 10, 12}) {
+        auto start = Clock::now();
+        auto coarse = PointCloudCodec::decodeLevel(stream, level);
+        double decodeMs = elapsedMs(start);
+        size_t bytes =
+            PointCloudCodec::levelSize(stream.data(), stream.size(), level);
+        std::cout << "  " << std::setw(5) << level << std::setw(12)
+                  << coarse->vertices.size() << std::fixed
+                  << std::setprecision(1) << std::setw(12)
+                  << 100.0 * bytes / stream.size() << "%" << std::setw(12)
+                  << decodeMs << "\n";
+    }
+}
+
+void benchRegionDecode(const Model& model) {
+    std::cout << "region decode of a depth 12 stream, boxes around a point\n"
+              << "  edge/root      points   decode ms\n";
+    Cube cube = rootCube(model);
+    auto stream =
+        PointCloudCodec::encode(model, cube.center, cube.halfSize, 12);
+    auto start = Clock::now();
+    auto full = PointCloudCodec::decode(stream);
+    double fullMs = elapsedMs(start);
+    const glm::vec3& anchor = model.vertices[model.vertices.size() / 2];
+    for (float fraction : {1.0f / 32, 1.0f / 8, 1.0f / 2, 2.0f}) {
+        glm::vec3 half(fraction * cube.halfSize);
+        start = Clock::now();
+        auto region =
+            PointCloudCodec::decodeRegion(stream, anchor - half, anchor + half);
+        double regionMs = elapsedMs(start);
+        std::cout << std::fixed << std::setprecision(4) << std::setw(11)
+                  << fraction << std::setw(12) << region->vertices.size()
+                  << std::setprecision(1) << std::setw(12) << regionMs
+                  << "\n";
+    }
+    std::cout << "  full decode " << full->vertices.size() << " points in "
+              << fullMs << " ms\n";
+}
+
+void benchSubtreeSplit(const Model& model) {
+    std::cout << "subtree split level of a depth 12 stream (ratio cost "
+                 "against no split, share read to decode level 8)\n"
+              << "  split   bits/pt      cost   level 8   encode ms (1/all "
+                 "threads)   decode ms (1/all threads)\n";
+    Cube cube = rootCube(model);
+    double unsplitBytes = 0.0;
+    for (int split : {12, 1, 2, 3, 4, 5}) {
+        PointCloudCodec::Options options;
+        options.subtreeLevel = split;
+        double encodeMs[2];
+        double decodeMs[2];
+        std::vector<uint8_t> streams[2];
+        for (int run = 0; run < 2; ++run) {
+            options.threadCount = run == 0 ? 1 : 0;
+            auto start = Clock::now();
+            streams[run] = PointCloudCodec::encode(
+                model, cube.center, cube.halfSize, 12, options);
+            encodeMs[run] = elapsedMs(start);
+            start = Clock::now();
+            PointCloudCodec::decode(streams[run], options.threadCount);
+            decodeMs[run] = elapsedMs(start);
+        }
+        double bytes = static_cast<double>(streams[0].size());
+        if (split == 12) unsplitBytes = bytes;
+        // The split must not change how far a prefix decodes
+        double levelShare = 100.0 *
+                            PointCloudCodec::levelSize(streams[0].data(),
+                                                       streams[0].size(), 8) /
+                            bytes;
+        std::cout << "  " << std::setw(5);
+        if (split == 12) {
+            std::cout << "none";
+        } else {
+            std::cout << split;
+        }
+        std::cout << std::fixed << std::setprecision(2) << std::setw(10)
+                  << bytes * 8.0 / model.vertices.size() << std::setprecision(1)
+                  << std::setw(9) << 100.0 * (bytes / unsplitBytes - 1.0)
+                  << "%" << std::setw(9) << levelShare << "%" << std::setw(14)
+                  << encodeMs[0] << " /" << std::setw(8)
+                  << encodeMs[1] << std::setw(16) << decodeMs[0] << " /"
+                  << std::setw(8) << decodeMs[1]
+                  << (streams[0] == streams[1] ? "" : "  NOT DETERMINISTIC")
+                  << "\n";
+    }
+}
+
+void benchOutOfCore(const Model& model) {
+    std::cout << "out-of-core encode of a depth 12 stream, split 3, pushed "
+                 "in chunks of 64k points\n"
+              << "  memory limit   encode ms\n";
+    Cube cube = rootCube(model);
+    auto start = Clock::now();
+    auto stream =
+        PointCloudCodec::encode(model, cube.center, cube.halfSize, 12);
+    std::cout << std::fixed << std::setprecision(1) << "     in memory"
+              << std::setw(12) << elapsedMs(start) << "\n";
+
+    std::string path =
+        (std::filesystem::temp_directory_path() / "octree_bench.octg")
+            .string();
+    const size_t chunk = size_t(1) << 16;
+    for (size_t limitMiB : {256, 16, 2}) {
+        start = Clock::now();
+        PointCloudCodec::FileEncoder encoder(path, cube.center, cube.halfSize,
+                                             12, PointCloudCodec::Options(),
+                                             limitMiB << 20);
+        for (size_t i = 0; i < model.vertices.size(); i += chunk) {
+            size_t count = std::min(chunk, model.vertices.size() - i);
+            encoder.push(&model.vertices[i], &model.colors[i], count);
+        }
+        encoder.finish();
+        double encodeMs = elapsedMs(start);
+        bool same = PointCloudCodec::readFile(path) == stream;
+        std::cout << std::setw(10) << limitMiB << " MiB" << std::setw(12)
+                  << encodeMs << (same ? "" : "  (differs from encode)")
+                  << "\n";
+    }
+    std::filesystem::remove(path);
+}
+
+// Tree depth versus query cost for a range of leaf capacities and minimum
+// node sizes (given as a fraction of the root edge length).
+void benchLeafSweep(const Model& model) {
+    std::cout << "leaf capacity / min node size sweep, maxDepth 12\n"
+              << "  capacity  minSize     build ms     nodes  depth"
+                 "   window ms     full ms\n";
+    Cube cube = rootCube(model);
+    auto makeItem = [&](size_t i) {
+        return VertexData(model.vertices[i], model.colors[i]);
+    };
+    glm::vec3 window(cube.halfSize * 0.2f);
+
+    for (size_t capacity : {4, 8, 16, 32, 64}) {
+        for (float fraction : {0.0f, 1.0f / 512, 1.0f / 64}) {
+            float minNodeSize = fraction * 2.0f * cube.halfSize;
+
+            auto start = Clock::now();
+            Octree<VertexData> tree(cube.center, cube.halfSize, 12, capacity,
+                                    minNodeSize);
+            tree.build(model.vertices, makeItem);
+            double buildMs = elapsedMs(start);
+
+            // Windows centred on a spread of input points
+            start = Clock::now();
+            size_t windowHits = 0;
+            size_t stride = std::max<size_t>(model.vertices.size() / 64, 1);
+            for (size_t i = 0; i < model.vertices.size(); i += stride) {
+                const glm::vec3& p = model.vertices[i];
+                windowHits += tree.query(p - window, p + window).size();
+            }
+            double windowMs = elapsedMs(start);
+
+            start = Clock::now();
+            size_t found = tree.query(model.minBounds, model.maxBounds).size();
+            double fullMs = elapsedMs(start);
+
+            std::cout << std::fixed << std::setw(10) << capacity
+                      << std::setprecision(4) << std::setw(9) << fraction
+                      << std::setprecision(1) << std::setw(13) << buildMs
+                      << std::setw(10) << tree.getNodeCount() << std::setw(7)
+                      << tree.getActualMaxDepth() << std::setw(12) << windowMs
+                      << std::setw(12) << fullMs;
+            if (found != model.vertices.size() || windowHits == 0) {
+                std::cout << "  (lost points)";
+            }
+            std::cout << "\n";
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t syntheticPoints = 1000000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--points" && i + 1 < argc) {
+            syntheticPoints = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    std::vector<std::pair<std::string, std::unique_ptr<Model>>> models;
+    OBJLoader loader;
+    for (const auto& file : files) {
+        try {
+            models.emplace_back(file, loader.load(file));
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping " << file << ": " << e.what() << std::endl;
+        }
+    }
+    if (models.empty()) {
+        models.emplace_back("synthetic sphere",
+                            makeSyntheticModel(syntheticPoints));
+    }
+
+    for (const auto& [name, model] : models) {
+        std::cout << "== " << name << " (" << model->vertices.size()
+                  << " points)\n";
+        benchStorage(*model);
+        benchBulkBuild(*model);
+        benchUpdates(*model);
+        benchQueryApi(*model);
+        benchWindowQueries(*model);
+        benchNeighbors(*model);
+        benchPersistence(*model);
+        benchCodec(*model);
+        benchStreamCodecs(*model);
+        benchColorQuality(*model);
+        benchLevelOfDetail(*model);
+        benchRegionDecode(*model);
+        benchSubtreeSplit(*model);
+        benchOutOfCore(*model);
+        benchLeafSweep(*model);
+    }
+
+    return 0;
+}
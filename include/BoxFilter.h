@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCTREE_BOX_FILTER_SSE2 1
+#endif
+
+// Point-in-box tests over a tightly packed positions array. The SSE2 path
+// tests four points per step straight from the interleaved x,y,z layout:
+// three unaligned loads cover four points, each lane is compared against
+// min/max broadcast in the matching x,y,z rotation, and a point is inside
+// when all three of its lanes pass.
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float),
+              "BoxFilter expects tightly packed glm::vec3");
+
+inline bool inBox(const glm::vec3& p, const glm::vec3& min,
+                  const glm::vec3& max) {
+    return p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y &&
+           p.z >= min.z && p.z <= max.z;
+}
+
+// Points can sit a few ulps outside their octree node's nominal cube
+// because child centers are rounded. Containment and distance bounds pad
+// the cube by that error so they stay conservative.
+inline float paddedHalfSize(const glm::vec3& center, float halfSize) {
+    glm::vec3 extent = glm::abs(center) + glm::vec3(halfSize);
+    return halfSize + 4.0f * std::numeric_limits<float>::epsilon() *
+                          std::max({extent.x, extent.y, extent.z});
+}
+
+inline bool cubeIntersectsBox(const glm::vec3& center, float halfSize,
+                              const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 cubeMin = center - glm::vec3(halfSize);
+    glm::vec3 cubeMax = center + glm::vec3(halfSize);
+    return !(min.x > cubeMax.x || max.x < cubeMin.x || min.y > cubeMax.y ||
+             max.y < cubeMin.y || min.z > cubeMax.z || max.z < cubeMin.z);
+}
+
+// True when every point stored under a node with this cube is inside
+// [min, max].
+inline bool cubeInsideBox(const glm::vec3& center, float halfSize,
+                          const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 half(paddedHalfSize(center, halfSize));
+    glm::vec3 cubeMin = center - half;
+    glm::vec3 cubeMax = center + half;
+    return cubeMin.x >= min.x && cubeMax.x <= max.x && cubeMin.y >= min.y &&
+           cubeMax.y <= max.y && cubeMin.z >= min.z && cubeMax.z <= max.z;
+}
+
+#ifdef OCTREE_BOX_FILTER_SSE2
+namespace box_filter_detail {
+
+// 12-bit mask, three bits per point, for four consecutive points.
+inline unsigned laneMask(const float* xyz, const __m128 mins[3],
+                         const __m128 maxs[3]) {
+    unsigned mask = 0;
+    for (int r = 0; r < 3; ++r) {
+        __m128 v = _mm_loadu_ps(xyz + 4 * r);
+        __m128 ok = _mm_and_ps(_mm_cmpge_ps(v, mins[r]),
+                               _mm_cmple_ps(v, maxs[r]));
+        mask |= static_cast<unsigned>(_mm_movemask_ps(ok)) << (4 * r);
+    }
+    return mask;
+}
+
+// Bit k set when point k of the group has all three lanes inside.
+inline unsigned pointMask(unsigned laneBits) {
+    unsigned all = laneBits & (laneBits >> 1) & (laneBits >> 2);
+    return (all & 1u) | ((all >> 2) & 2u) | ((all >> 4) & 4u) |
+           ((all >> 6) & 8u);
+}
+
+inline void broadcast(const glm::vec3& v, __m128 out[3]) {
+    // Lane order of the three loads: xyzx, yzxy, zxyz
+    out[0] = _mm_setr_ps(v.x, v.y, v.z, v.x);
+    out[1] = _mm_setr_ps(v.y, v.z, v.x, v.y);
+    out[2] = _mm_setr_ps(v.z, v.x, v.y, v.z);
+}
+
+}  // namespace box_filter_detail
+#endif
+
+// Calls fn(i) for every positions[i] inside [min, max], in index order.
+template <typename Fn>
+inline void forEachInBox(const glm::vec3* positions, size_t count,
+                         const glm::vec3& min, const glm::vec3& max, Fn&& fn) {
+    size_t i = 0;
+#ifdef OCTREE_BOX_FILTER_SSE2
+    using namespace box_filter_detail;
+    __m128 mins[3], maxs[3];
+    broadcast(min, mins);
+    broadcast(max, maxs);
+    for (; i + 4 <= count; i += 4) {
+        unsigned points = pointMask(
+            laneMask(reinterpret_cast<const float*>(positions + i), mins,
+                     maxs));
+        for (size_t k = 0; points; ++k, points >>= 1) {
+            if (points & 1u) fn(i + k);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        if (inBox(positions[i], min, max)) fn(i);
+    }
+}
+
+// Number of positions inside [min, max].
+inline size_t countInBox(const glm::vec3* positions, size_t count,
+                         const glm::vec3& min, const glm::vec3& max) {
+    size_t inside = 0;
+    size_t i = 0;
+#ifdef OCTREE_BOX_FILTER_SSE2
+    using namespace box_filter_detail;
+    __m128 mins[3], maxs[3];
+    broadcast(min, mins);
+    broadcast(max, maxs);
+    for (; i + 4 <= count; i += 4) {
+        unsigned points = pointMask(
+            laneMask(reinterpret_cast<const float*>(positions + i), mins,
+                     maxs));
+        inside += (points & 1u) + ((points >> 1) & 1u) + ((points >> 2) & 1u) +
+                  ((points >> 3) & 1u);
+    }
+#endif
+    for (; i < count; ++i) {
+        inside += inBox(positions[i], min, max) ? 1 : 0;
+    }
+    return inside;
+}
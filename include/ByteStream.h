@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Little-endian byte serialization helpers for the encoded point cloud
+// streams. Readers throw std::runtime_error instead of running past the
+// end of their input.
+
+class ByteWriter {
+   public:
+    explicit ByteWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void u8(uint8_t value) { out.push_back(value); }
+    void u32(uint32_t value) { little(value, 4); }
+    void u64(uint64_t value) { little(value, 8); }
+    void f32(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        u32(bits);
+    }
+    void bytes(const void* data, size_t size) {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), begin, begin + size);
+    }
+    void bytes(const std::vector<uint8_t>& data) {
+        bytes(data.data(), data.size());
+    }
+    // Unsigned LEB128
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    // Length-prefixed block
+    void block(const std::vector<uint8_t>& data) {
+        u64(data.size());
+        bytes(data);
+    }
+
+    size_t size() const { return out.size(); }
+
+   private:
+    std::vector<uint8_t>& out;
+
+    void little(uint64_t value, int count) {
+        for (int i = 0; i < count; ++i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+};
+
+class ByteReader {
+   public:
+    ByteReader(const uint8_t* data, size_t size)
+        : data(data), size(size), offset(0) {}
+
+    uint8_t u8() { return *take(1); }
+    uint32_t u32() { return static_cast<uint32_t>(little(4)); }
+    uint64_t u64() { return little(8); }
+    float f32() {
+        uint32_t bits = u32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    const uint8_t* bytes(size_t count) { return take(count); }
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        fail("varint too long");
+        return 0;
+    }
+    // Length-prefixed block, returned as a reader over its bytes
+    ByteReader block() {
+        uint64_t length = u64();
+        if (length > remaining()) fail("block exceeds stream");
+        const uint8_t* begin = take(static_cast<size_t>(length));
+        return ByteReader(begin, static_cast<size_t>(length));
+    }
+
+    size_t remaining() const { return size - offset; }
+    size_t position() const { return offset; }
+    bool atEnd() const { return offset == size; }
+    const uint8_t* current() const { return data + offset; }
+
+    [[noreturn]] static void fail(const std::string& what) {
+        throw std::runtime_error("Corrupt point cloud stream: " + what);
+    }
+
+   private:
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+
+    const uint8_t* take(size_t count) {
+        if (count > remaining()) fail("unexpected end of data");
+        const uint8_t* at = data + offset;
+        offset += count;
+        return at;
+    }
+    uint64_t little(int count) {
+        const uint8_t* at = take(count);
+        uint64_t value = 0;
+        for (int i = 0; i < count; ++i) {
+            value |= static_cast<uint64_t>(at[i]) << (8 * i);
+        }
+        return value;
+    }
+};
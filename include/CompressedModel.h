@@ -1,27 +1,88 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
+#include "MappedOctree.h"
 #include "Octree.h"
 #include "VertexData.h"
 
+class MappedFile;
 class Model;
 
 class CompressedModel {
    public:
     using VertexOctree = Octree<VertexData>;
+    using MappedVertexOctree = MappedOctree<VertexData>;
 
     CompressedModel(std::unique_ptr<VertexOctree> octree,
                     const glm::vec3& minBounds, const glm::vec3& maxBounds);
+    ~CompressedModel();
 
     std::unique_ptr<Model> decompress() const;
+    // Coarse preview from the encoded stream: one point per occupied node
+    // at level (see PointCloudCodec::decodeLevel).
+    std::unique_ptr<Model> decompressLevel(int level) const;
+    // Points of the encoded stream inside the box, decoding only the
+    // subtrees that meet it (see PointCloudCodec::decodeRegion).
+    std::unique_ptr<Model> decompressRegion(const glm::vec3& min,
+                                            const glm::vec3& max) const;
+    std::vector<VertexData> query(const glm::vec3& min,
+                                  const glm::vec3& max) const;
+    // Size of the encoded stream.
     size_t getCompressedSize() const;
     size_t getVertexCount() const;
+    int getActualMaxDepth() const;
 
-    // Add getter for octree visualization
+    // Binary container holding the octree structure and leaf payloads (see
+    // OctreeFormat.h). Loading rebuilds the octree without re-insertion.
+    void save(const std::string& filename) const;
+    static std::unique_ptr<CompressedModel> load(const std::string& filename);
+    static bool isCompressedModelFile(const std::string& filename);
+
+    // Read-only model that queries a saved file in place through a shared
+    // memory mapping. Opening reads only the headers; pages are faulted in
+    // as traversals touch them and are shared between processes.
+    static std::unique_ptr<CompressedModel> map(const std::string& filename);
+    bool isMapped() const { return mappedOctree != nullptr; }
+
+    // Compact encoding of the model (see PointCloudCodec.h). The compressor
+    // makes it at compression time when its encodeStream setting is on;
+    // otherwise the first call encodes the tree at its maxDepth with the
+    // default options, and the result is kept for later calls.
+    const std::vector<uint8_t>& getEncodedStream() const;
+    void setEncodedStream(std::vector<uint8_t> stream) {
+        encodedStream = std::move(stream);
+    }
+
+    // Add getter for octree visualization. Exactly one of these is non-null.
     const VertexOctree* getOctree() const { return octree.get(); }
+    const MappedVertexOctree* getMappedOctree() const {
+        return mappedOctree.get();
+    }
 
    private:
+    CompressedModel(std::unique_ptr<MappedFile> file,
+                    const glm::vec3& minBounds, const glm::vec3& maxBounds);
+
+    // Calls fn with whichever tree backs this model.
+    template <typename Fn>
+    void withTree(Fn&& fn) const {
+        if (octree) {
+            fn(*octree);
+        } else {
+            fn(*mappedOctree);
+        }
+    }
+
     std::unique_ptr<VertexOctree> octree;
+    std::unique_ptr<MappedFile> mappedFile;
+    std::unique_ptr<MappedVertexOctree> mappedOctree;
+    // Filled on demand by getEncodedStream(), under encodeMutex
+    mutable std::vector<uint8_t> encodedStream;
+    mutable std::mutex encodeMutex;
     glm::vec3 minBounds;
     glm::vec3 maxBounds;
 };
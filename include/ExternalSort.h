@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TempFile.h"
+
+// Point reduced to what encoding needs once its cell is known.
+struct MortonPoint {
+    uint64_t key;
+    glm::vec3 color;
+};
+
+// Sorts more points than fit in memory by Morton key. Pushed points are
+// buffered up to the memory limit; each full buffer is radix sorted and
+// spilled to a temporary file as a run, and the runs are k-way merged as
+// the points are read back. When the memory cannot hold a read buffer for
+// every run, groups of runs are first merged into longer ones. Points that
+// fit in one buffer never touch the disk. The sort is stable: points with
+// equal keys come out in the order they were pushed.
+class ExternalMortonSort {
+   public:
+    // Keys have keyBits significant bits. tempDirectory as for TempFile.
+    ExternalMortonSort(int keyBits, size_t memoryLimit,
+                       const std::string& tempDirectory = "");
+    ~ExternalMortonSort();
+
+    void push(const MortonPoint& point);
+    // Ends the input; next() then returns the points in key order.
+    void finish();
+    bool next(MortonPoint& point);
+
+    uint64_t size() const { return count; }
+    // Runs written to disk, including those of intermediate merges
+    size_t spilledRuns() const { return spilled; }
+
+   private:
+    class Merge;
+
+    void spill();
+    void sortBuffer(std::vector<MortonPoint>& sorted);
+
+    int keyBits;
+    size_t memoryLimit;
+    std::string tempDirectory;
+    size_t capacity;
+    uint64_t count;
+    size_t spilled;
+
+    std::vector<MortonPoint> buffer;
+    size_t position;
+    std::vector<std::unique_ptr<TempFile>> runs;
+    std::unique_ptr<Merge> merge;
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are shared with the page
+// cache, so several processes mapping the same file share one copy.
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+   private:
+    const unsigned char* bytes;
+    size_t length;
+};
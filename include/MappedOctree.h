@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <stdexcept>
+#include <vector>
+
+#include "BoxFilter.h"
+#include "Octree.h"
+#include "OctreeFormat.h"
+
+// Read-only octree over a serialized octree section (see OctreeFormat.h)
+// used in place, typically from a memory-mapped file. Opening only checks
+// the section header; node records are validated as traversals reach them.
+// The section memory must outlive the tree.
+template <typename T>
+class MappedOctree {
+   public:
+    using NodeIndex = uint32_t;
+    using Cube = typename Octree<T>::Cube;
+    using Traits = OctreeItemTraits<T>;
+    using Payload = typename Traits::Payload;
+    static constexpr NodeIndex kNullNode = Octree<T>::kNullNode;
+
+    // Decoded view of one node record. Like Octree<T>, nodes carry no cube;
+    // traversals derive it with getChildCube() from getRootCube().
+    struct Node {
+        NodeIndex firstChild;
+        uint32_t firstItem;
+        uint32_t itemCount;
+        unsigned childMask;
+
+        bool isLeaf() const { return firstChild == kNullNode; }
+        unsigned childCount() const { return popcount8(childMask); }
+    };
+
+    MappedOctree(const unsigned char* section, size_t available) {
+        if (available < sizeof(OctreeFileHeader)) {
+            throw std::runtime_error("Octree section is truncated");
+        }
+        std::memcpy(&header, section, sizeof(header));
+        Octree<T>::validateHeader(header, sizeof(Payload));
+        if (header.sectionSize > available) {
+            throw std::runtime_error("Octree section is truncated");
+        }
+
+        records = reinterpret_cast<const OctreeNodeRecord*>(
+            section + header.nodeOffset);
+        positions =
+            reinterpret_cast<const glm::vec3*>(section + header.positionOffset);
+        items = reinterpret_cast<const Payload*>(section + header.itemOffset);
+    }
+
+    std::vector<T> query(const glm::vec3& min, const glm::vec3& max) const {
+        std::vector<T> results;
+        queryEach(min, max,
+                  [&](const Payload& item, const glm::vec3& position) {
+                      results.push_back(Traits::unpack(item, position));
+                  });
+        return results;
+    }
+
+    // Same contracts as the Octree<T> queries of the same name. References
+    // point into the mapped section.
+    template <typename Visitor>
+    void queryEach(const glm::vec3& min, const glm::vec3& max,
+                   Visitor&& visit) const {
+        queryBuckets(min, max,
+                     [&](const Payload* bucket,
+                         const glm::vec3* bucketPositions, size_t count,
+                         bool inside) {
+                         auto visitItem = [&](size_t i) {
+                             visit(bucket[i], bucketPositions[i]);
+                         };
+                         if (inside) {
+                             for (size_t i = 0; i < count; ++i) visitItem(i);
+                         } else {
+                             forEachInBox(bucketPositions, count, min, max,
+                                          visitItem);
+                         }
+                     });
+    }
+
+    template <typename Visitor>
+    void queryBuckets(const glm::vec3& min, const glm::vec3& max,
+                      Visitor&& visit) const {
+        queryHelper(kRoot, getRootCube(), min, max, visit, false);
+    }
+
+    size_t queryCount(const glm::vec3& min, const glm::vec3& max) const {
+        size_t count = 0;
+        queryBuckets(min, max,
+                     [&](const Payload*, const glm::vec3* bucketPositions,
+                         size_t size, bool inside) {
+                         count += inside ? size
+                                         : countInBox(bucketPositions, size,
+                                                      min, max);
+                     });
+        return count;
+    }
+
+    size_t size() const { return header.itemCount; }
+
+    NodeIndex getRootIndex() const { return kRoot; }
+    Cube getRootCube() const {
+        return {glm::vec3(header.rootCenter[0], header.rootCenter[1],
+                          header.rootCenter[2]),
+                header.rootHalfSize};
+    }
+    static Cube getChildCube(const Cube& cube, int octant) {
+        return Octree<T>::getChildCube(cube, octant);
+    }
+    Node getNode(NodeIndex index) const {
+        const OctreeNodeRecord& record = records[index];
+        unsigned childMask = record.childMask;
+        bool badChild =
+            record.childMask > 0xFF ||
+            (record.firstChild == kNullNode) != (record.childMask == 0) ||
+            (record.firstChild != kNullNode &&
+             (record.firstChild <= index ||
+              uint64_t(record.firstChild) + popcount8(childMask) >
+                  header.nodeCount));
+        if (badChild || uint64_t(record.firstItem) + record.itemCount >
+                            header.itemCount) {
+            throw std::runtime_error("Octree node records are corrupt");
+        }
+        return {record.firstChild, record.firstItem, record.itemCount,
+                childMask};
+    }
+    // kNullNode for an octant without a child.
+    NodeIndex getChild(const Node& node, int octant) const {
+        return (node.childMask >> octant) & 1
+                   ? node.firstChild + childRank(node.childMask, octant)
+                   : kNullNode;
+    }
+    size_t getItemCount(const Node& node) const { return node.itemCount; }
+    size_t getNodeCount() const { return header.nodeCount; }
+    int getMaxDepth() const { return header.maxDepth; }
+    int getActualMaxDepth() const { return header.actualMaxDepth; }
+
+   private:
+    static constexpr NodeIndex kRoot = 0;
+
+    OctreeFileHeader header;
+    const OctreeNodeRecord* records;
+    const glm::vec3* positions;
+    const Payload* items;
+
+    template <typename Visitor>
+    void queryHelper(NodeIndex index, const Cube& cube, const glm::vec3& min,
+                     const glm::vec3& max, Visitor& visit, bool inside) const {
+        if (!inside) {
+            if (!cubeIntersectsBox(cube.center, cube.halfSize, min, max)) {
+                return;
+            }
+            inside = cubeInsideBox(cube.center, cube.halfSize, min, max);
+        }
+
+        Node node = getNode(index);
+
+        if (node.itemCount > 0) {
+            visit(items + node.firstItem, positions + node.firstItem,
+                  size_t(node.itemCount), inside);
+        }
+
+        NodeIndex child = node.firstChild;
+        for (int octant = 0; octant < 8; ++octant) {
+            if (!((node.childMask >> octant) & 1)) continue;
+            queryHelper(child++, getChildCube(cube, octant), min, max, visit,
+                        inside);
+        }
+    }
+};
@@ -14,8 +14,19 @@ class ModelManager {
 
     std::unique_ptr<Model> loadModel(const std::string& filename);
     std::unique_ptr<CompressedModel> compressModel(const Model& model);
+    // Loads a saved compressed model directly, decodes and recompresses an
+    // encoded stream, or loads and compresses any other model file.
     std::unique_ptr<CompressedModel> loadCompressedModel(
         const std::string& filename);
+    void saveCompressedModel(const CompressedModel& model,
+                             const std::string& filename);
+    // Writes the model's PointCloudCodec stream, encoding its octree when
+    // it was compressed without one.
+    void saveEncodedModel(const CompressedModel& model,
+                          const std::string& filename);
+    // Read-only model served straight from a memory-mapped saved file.
+    std::unique_ptr<CompressedModel> mapCompressedModel(
+        const std::string& filename);
 
    private:
     std::unique_ptr<IModelLoader> loader;
@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Octant path of a point packed three bits per level, root level in the most
+// significant bits. Sorting by key yields Z-order (depth-first octree order).
+// index is the point's position in the caller's input; it is 64 bits wide,
+// which the key's alignment pads the entry to anyway, so clouds of any size
+// keep their points paired with their attributes.
+struct MortonEntry {
+    uint64_t key;
+    uint64_t index;
+};
+
+static_assert(sizeof(MortonEntry) == 16, "unexpected Morton entry size");
+
+// 21 levels of 3 bits fill a 64-bit key.
+constexpr int kMaxMortonDepth = 21;
+
+// Stable LSD radix sort of [begin, end) on the low keyBits bits of each key,
+// one byte per pass. scratch must hold end - begin entries. Entries with
+// equal keys keep their input order.
+inline void radixSortMorton(MortonEntry* begin, MortonEntry* end,
+                            MortonEntry* scratch, int keyBits) {
+    size_t count = static_cast<size_t>(end - begin);
+    if (count < 2 || keyBits <= 0) return;
+
+    MortonEntry* source = begin;
+    MortonEntry* target = scratch;
+    for (int shift = 0; shift < keyBits; shift += 8) {
+        std::array<size_t, 257> offsets{};
+        for (size_t i = 0; i < count; ++i) {
+            ++offsets[((source[i].key >> shift) & 0xFF) + 1];
+        }
+        for (size_t i = 1; i < offsets.size(); ++i) {
+            offsets[i] += offsets[i - 1];
+        }
+        for (size_t i = 0; i < count; ++i) {
+            target[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+        }
+        std::swap(source, target);
+    }
+    if (source != begin) std::copy(source, source + count, begin);
+}
+
+inline void radixSortMorton(std::vector<MortonEntry>& entries, int keyBits) {
+    std::vector<MortonEntry> scratch(entries.size());
+    radixSortMorton(entries.data(), entries.data() + entries.size(),
+                    scratch.data(), keyBits);
+}
+
+// Spreads the low 21 bits of v so that bit i lands at bit 3 * i.
+inline uint64_t mortonSpread(uint32_t v) {
+    uint64_t x = v & 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFFull;
+    x = (x | x << 16) & 0x1F0000FF0000FFull;
+    x = (x | x << 8) & 0x100F00F00F00F00Full;
+    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+inline uint32_t mortonCompact(uint64_t x) {
+    x &= 0x1249249249249249ull;
+    x = (x | x >> 2) & 0x10C30C30C30C30C3ull;
+    x = (x | x >> 4) & 0x100F00F00F00F00Full;
+    x = (x | x >> 8) & 0x1F0000FF0000FFull;
+    x = (x | x >> 16) & 0x1F00000000FFFFull;
+    x = (x | x >> 32) & 0x1FFFFF;
+    return static_cast<uint32_t>(x);
+}
+
+// Key of integer grid cell (x, y, z). x takes the lowest bit of each octant
+// triple, matching Octree's octant numbering (x = 1, y = 2, z = 4).
+inline uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z) {
+    return mortonSpread(x) | mortonSpread(y) << 1 | mortonSpread(z) << 2;
+}
+
+inline void mortonDecode(uint64_t key, uint32_t& x, uint32_t& y,
+                         uint32_t& z) {
+    x = mortonCompact(key);
+    y = mortonCompact(key >> 1);
+    z = mortonCompact(key >> 2);
+}
@@ -1,101 +1,1250 @@
 #pragma once
 #include <algorithm>
-#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <glm/glm.hpp>
+#include <istream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 
+#include "BoxFilter.h"
+#include "Morton.h"
+#include "OctreeFormat.h"
+#include "OctreeItemTraits.h"
+#include "Parallel.h"
+
 template <typename T>
 class Octree {
    public:
-    struct Node {
+    // Nodes live in one contiguous arena and refer to each other by 32-bit
+    // index instead of owning pointers.
+    using NodeIndex = uint32_t;
+    static constexpr NodeIndex kNullNode =
+        std::numeric_limits<NodeIndex>::max();
+    // What the buckets hold for each item (see OctreeItemTraits.h).
+    using Traits = OctreeItemTraits<T>;
+    using Payload = typename Traits::Payload;
+
+    // Cube of a node. Nodes do not store it: it follows from the root cube
+    // and the octants on the way down (see getChildCube()), so traversals
+    // carry it along.
+    struct Cube {
         glm::vec3 center;
         float halfSize;
-        std::vector<T> data;
-        std::array<std::unique_ptr<Node>, 8> children;
+    };
 
-        bool isLeaf() const { return !children[0]; }
+    struct Node {
+        // The node's bucket: its items are slots [firstItem, firstItem +
+        // itemCount) of the tree's item array, in insertion order, and their
+        // positions the same slots of the position array. The block reserved
+        // for the bucket has itemCapacity slots.
+        uint32_t firstItem = 0;
+        uint32_t itemCount = 0;
+        uint32_t itemCapacity = 0;
+        // Children exist only in the octants set in childMask. They are one
+        // run of consecutive arena nodes in octant order, so octant i's child
+        // is firstChild + childRank(childMask, i) (see OctreeFormat.h).
+        NodeIndex firstChild = kNullNode;
+        uint8_t childMask = 0;
+
+        bool isLeaf() const { return firstChild == kNullNode; }
+        unsigned childCount() const { return popcount8(childMask); }
     };
 
-    Octree(const glm::vec3& center, float halfSize, int maxDepth = 8)
-        : maxDepth(maxDepth), actualMaxDepth(0) {
-        root = std::make_unique<Node>();
-        root->center = center;
-        root->halfSize = halfSize;
+    // A leaf splits once it holds more than leafCapacity items, unless it is
+    // at maxDepth or its children would be smaller than minNodeSize (edge
+    // length). Leaves that cannot split keep every item they receive.
+    //
+    // remove() and move() merge the children of a node back into it once
+    // they are all leaves holding no more than leafCapacity items together,
+    // and fewer than minPointsPerNode. By default that is as soon as they
+    // fit in one leaf; a lower value keeps sparse subtrees split, so points
+    // moving back and forth across a node do not split and merge it over
+    // and over.
+    //
+    // Points outside the root cube are dropped, unless growRoot is set: the
+    // root then grows toward them, doubling its edge per step, so a tree
+    // can take points without knowing their bounds up front. A leaf root
+    // grows in place; otherwise the old root becomes a child of the new
+    // one. Each step raises maxDepth by one, so the deepest cells keep
+    // their size. Non-finite points are still dropped.
+    Octree(const glm::vec3& center, float halfSize, int maxDepth = 8,
+           size_t leafCapacity = 8, float minNodeSize = 0.0f,
+           bool growRoot = false,
+           size_t minPointsPerNode = std::numeric_limits<size_t>::max())
+        : maxDepth(maxDepth),
+          leafCapacity(leafCapacity),
+          minNodeSize(minNodeSize),
+          growRoot(growRoot),
+          minPointsPerNode(minPointsPerNode),
+          rootCube{center, halfSize},
+          depthLimit(0),
+          actualMaxDepth(0),
+          itemCount(0) {
+        nodes.emplace_back();
+        updateDepthLimit();
     }
 
     void insert(const T& item, const glm::vec3& position) {
-        insertHelper(root.get(), item, position, 0);
+        if (!contains(rootCube, position) && !growToward(position)) {
+            return;
+        }
+        insertHelper(kRoot, rootCube, Traits::pack(item), position, 0);
+        ++itemCount;
+    }
+
+    // Inserts count points at once, leaving the tree exactly as inserting
+    // them one by one in index order would. makeItem(i) returns the item
+    // stored for positions[i]. Instead of descending from the root for
+    // every point, the batch is Morton-sorted and each node is visited
+    // once: it hands every child the run of points that falls in it, and
+    // a leaf takes its whole run at once, splitting first when the run
+    // would overflow it. The root grows between runs, as the points that
+    // need it arrive. Meant for streaming ingest into a tree that already
+    // holds points, which build() cannot take.
+    template <typename MakeItem>
+    void insertBatch(const glm::vec3* positions, size_t count,
+                     MakeItem&& makeItem) {
+        size_t first = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (growRoot && !contains(rootCube, positions[i])) {
+                insertRun(positions, first, i, makeItem);
+                first = i;
+                growToward(positions[i]);
+            }
+        }
+        insertRun(positions, first, count, makeItem);
+    }
+
+    // items[i] goes at positions[i].
+    void insertBatch(const std::vector<T>& items,
+                     const std::vector<glm::vec3>& positions) {
+        if (items.size() != positions.size()) {
+            throw std::runtime_error(
+                "Batch items and positions differ in count");
+        }
+        insertBatch(positions.data(), positions.size(),
+                    [&](size_t i) { return items[i]; });
+    }
+
+    // Removes one item stored at exactly position for which match(const
+    // Payload&) holds, finding its node by the descent insert() takes, in
+    // O(depth). Nodes on the path whose children can merge back into them
+    // (see the constructor) are collapsed, bottom up, and the released
+    // child runs are reused by later splits. Returns false when there is no
+    // such item.
+    template <typename Match>
+    bool remove(const glm::vec3& position, Match&& match) {
+        std::vector<NodeIndex> path;
+        descend(position, path);
+        size_t item = findItem(nodes[path.back()], position, match);
+        if (item == kNoItem) return false;
+        eraseItem(path, item);
+        return true;
+    }
+
+    bool remove(const glm::vec3& position) {
+        return remove(position, [](const Payload&) { return true; });
+    }
+
+    // Moves one item stored at exactly from for which match(const Payload&)
+    // holds to position to, in O(depth). The item stays where it is when to
+    // falls in the same node; otherwise it is removed as by remove() and
+    // inserted again. Returns false, leaving the item in place, when there
+    // is no such item or the tree would drop to.
+    template <typename Match>
+    bool move(const glm::vec3& from, const glm::vec3& to, Match&& match) {
+        std::vector<NodeIndex> path;
+        descend(from, path);
+        size_t item = findItem(nodes[path.back()], from, match);
+        if (item == kNoItem) return false;
+        if (!contains(rootCube, to)) {
+            // Growing renumbers the nodes, so the item is looked up again
+            if (!growToward(to)) return false;
+            descend(from, path);
+            item = findItem(nodes[path.back()], from, match);
+            if (item == kNoItem) return false;
+        }
+
+        std::vector<NodeIndex> target;
+        descend(to, target);
+        const size_t slot = nodes[path.back()].firstItem + item;
+        if (target.back() == path.back()) {
+            bucketPositions[slot] = to;
+            return true;
+        }
+        Payload moved = std::move(bucketItems[slot]);
+        eraseItem(path, item);
+        insertHelper(kRoot, rootCube, moved, to, 0);
+        ++itemCount;
+        return true;
+    }
+
+    bool move(const glm::vec3& from, const glm::vec3& to) {
+        return move(from, to, [](const Payload&) { return true; });
+    }
+
+    // Bulk construction for an empty tree. Points are Morton-sorted and the
+    // tree is laid out in one sweep over the sorted order, producing the same
+    // topology and leaf contents as inserting them one by one in index order.
+    // makeItem(i) returns the item stored for positions[i]. A tree that
+    // already holds points takes them through insertBatch() instead.
+    //
+    // With threadCount != 1 (0 = all hardware threads) the keys are computed
+    // in parallel, the points are partitioned by their octant a few levels
+    // below the root, and each partition is sorted and built into its own
+    // subtree concurrently before being stitched under the shared root. The
+    // result is identical to the single-threaded build; makeItem must then
+    // be safe to call from several threads. A tree that grows its root
+    // first grows it over all the positions at once, which can leave it
+    // smaller than inserting them one by one would.
+    template <typename MakeItem>
+    void build(const std::vector<glm::vec3>& positions, MakeItem&& makeItem,
+               unsigned threadCount = 1) {
+        if (growRoot && nodes.size() == 1 && itemCount == 0) {
+            growOver(positions);
+        }
+        if (nodes.size() != 1 || itemCount != 0 ||
+            depthLimit > kMaxMortonDepth) {
+            insertBatch(positions.data(), positions.size(), makeItem);
+            return;
+        }
+
+        threadCount = resolveThreadCount(threadCount);
+        int keyDepth = depthLimit;
+        std::vector<MortonEntry> entries =
+            computeKeys(positions, keyDepth, threadCount);
+        if (entries.empty()) return;
+        itemCount += entries.size();
+
+        int splitDepth = 0;
+        if (threadCount > 1) {
+            // Enough partitions to keep every thread busy, within the first
+            // three levels so the partition pass stays a single histogram.
+            while (splitDepth < std::min(keyDepth, 3) &&
+                   (size_t(1) << (3 * splitDepth)) < 4 * size_t(threadCount)) {
+                ++splitDepth;
+            }
+        }
+
+        MortonEntry* begin = entries.data();
+        MortonEntry* end = begin + entries.size();
+        if (splitDepth == 0) {
+            radixSortMorton(entries, 3 * keyDepth);
+            buildRange(kRoot, rootCube, begin, end, 0, keyDepth, positions,
+                       makeItem);
+            return;
+        }
+
+        // Stable partition on the top splitDepth levels, then an independent
+        // sort of the remaining bits inside every partition.
+        int lowBits = 3 * (keyDepth - splitDepth);
+        std::vector<size_t> bounds(size_t(1) << (3 * splitDepth), 0);
+        std::vector<MortonEntry> scratch(entries.size());
+        {
+            std::vector<size_t> offsets(bounds.size() + 1, 0);
+            for (const auto& entry : entries) {
+                ++offsets[(entry.key >> lowBits) + 1];
+            }
+            for (size_t i = 1; i < offsets.size(); ++i) {
+                offsets[i] += offsets[i - 1];
+            }
+            std::copy(offsets.begin() + 1, offsets.end(), bounds.begin());
+            for (const auto& entry : entries) {
+                scratch[offsets[entry.key >> lowBits]++] = entry;
+            }
+            entries.swap(scratch);
+            begin = entries.data();
+            end = begin + entries.size();
+        }
+        parallelFor(bounds.size(), threadCount, [&](size_t bucket) {
+            size_t first = bucket == 0 ? 0 : bounds[bucket - 1];
+            radixSortMorton(begin + first, begin + bounds[bucket],
+                            scratch.data() + first, lowBits);
+        });
+        std::vector<MortonEntry>().swap(scratch);
+
+        std::vector<BuildTask> tasks;
+        buildRange(kRoot, rootCube, begin, end, 0, keyDepth, positions,
+                   makeItem, splitDepth, &tasks);
+
+        std::vector<std::unique_ptr<Octree>> subtrees(tasks.size());
+        parallelFor(tasks.size(), threadCount, [&](size_t i) {
+            const BuildTask& task = tasks[i];
+            subtrees[i] = std::make_unique<Octree>(
+                task.cube.center, task.cube.halfSize, maxDepth, leafCapacity,
+                minNodeSize);
+            subtrees[i]->depthLimit = depthLimit;
+            subtrees[i]->buildRange(kRoot, task.cube, task.begin, task.end,
+                                    task.depth, keyDepth, positions,
+                                    makeItem);
+        });
+
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            stitch(tasks[i].index, *subtrees[i]);
+            subtrees[i].reset();
+        }
     }
 
     std::vector<T> query(const glm::vec3& min, const glm::vec3& max) const {
         std::vector<T> results;
-        queryHelper(root.get(), min, max, results);
+        queryEach(min, max,
+                  [&](const Payload& item, const glm::vec3& position) {
+                      results.push_back(Traits::unpack(item, position));
+                  });
         return results;
     }
 
-    const Node* getRoot() const { return root.get(); }
+    // Calls visit(const Payload&, const glm::vec3& position) for every
+    // stored item inside [min, max]. Both are references into the tree;
+    // nothing is copied or unpacked, so an item type with a payload of its
+    // own (see OctreeItemTraits.h) is never rebuilt per visit.
+    template <typename Visitor>
+    void queryEach(const glm::vec3& min, const glm::vec3& max,
+                   Visitor&& visit) const {
+        queryBuckets(min, max,
+                     [&](const Payload* items, const glm::vec3* positions,
+                         size_t count, bool inside) {
+                         auto visitItem = [&](size_t i) {
+                             visit(items[i], positions[i]);
+                         };
+                         if (inside) {
+                             for (size_t i = 0; i < count; ++i) visitItem(i);
+                         } else {
+                             forEachInBox(positions, count, min, max,
+                                          visitItem);
+                         }
+                     });
+    }
+
+    // Calls visit(const Payload* items, const glm::vec3* positions, size_t
+    // count, bool inside) with the whole bucket of every node whose cube
+    // intersects [min, max]. When inside is true the node lies entirely
+    // within the box and every item matches; otherwise items near the box
+    // edges may lie outside it and need filtering.
+    template <typename Visitor>
+    void queryBuckets(const glm::vec3& min, const glm::vec3& max,
+                      Visitor&& visit) const {
+        queryHelper(kRoot, rootCube, min, max, visit, false);
+    }
+
+    // Number of stored items inside [min, max], without collecting them.
+    size_t queryCount(const glm::vec3& min, const glm::vec3& max) const {
+        size_t count = 0;
+        queryBuckets(min, max,
+                     [&](const Payload*, const glm::vec3* positions,
+                         size_t size, bool inside) {
+                         count += inside ? size
+                                         : countInBox(positions, size, min,
+                                                      max);
+                     });
+        return count;
+    }
+
+    // Total number of stored items.
+    size_t size() const { return itemCount; }
+
+    // Result of a neighbour search. Pointers refer into the tree and stay
+    // valid until it is modified; item points to the stored payload.
+    struct Neighbor {
+        const Payload* item;
+        const glm::vec3* position;
+        float distanceSquared;
+    };
+
+    // Reusable working memory for neighbour searches. Once it has grown to
+    // the size a query needs, later queries with the same scratch do not
+    // allocate. One scratch per thread.
+    struct SearchScratch {
+        struct QueuedNode {
+            float distanceSquared;
+            NodeIndex index;
+            Cube cube;
+        };
+        std::vector<QueuedNode> queue;
+    };
+
+    // Best-first k-nearest-neighbour search. Writes up to k neighbours of
+    // point to out, nearest first, and returns how many were found. out must
+    // have room for k entries and is used as the bounded result heap.
+    size_t nearest(const glm::vec3& point, size_t k, Neighbor* out,
+                   SearchScratch& scratch) const {
+        if (k == 0 || itemCount == 0) return 0;
+
+        auto byDistance = [](const Neighbor& a, const Neighbor& b) {
+            return a.distanceSquared < b.distanceSquared;
+        };
+        auto byQueueDistance = [](const typename SearchScratch::QueuedNode& a,
+                                  const typename SearchScratch::QueuedNode& b) {
+            return a.distanceSquared > b.distanceSquared;
+        };
+
+        // out[0, found) is a max-heap on distance while the search runs.
+        size_t found = 0;
+        auto& queue = scratch.queue;
+        queue.clear();
+        queue.push_back(
+            {boxDistanceSquared(rootCube, point), kRoot, rootCube});
+
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), byQueueDistance);
+            auto next = queue.back();
+            queue.pop_back();
+            if (found == k && next.distanceSquared >= out[0].distanceSquared) {
+                break;  // Nothing left can beat the current k-th neighbour
+            }
+
+            const Node& node = nodes[next.index];
+            const Payload* items = getItems(node);
+            const glm::vec3* positions = getPositions(node);
+            for (size_t i = 0; i < node.itemCount; ++i) {
+                glm::vec3 diff = positions[i] - point;
+                float d2 = glm::dot(diff, diff);
+                if (found < k) {
+                    out[found++] = {&items[i], &positions[i], d2};
+                    std::push_heap(out, out + found, byDistance);
+                } else if (d2 < out[0].distanceSquared) {
+                    std::pop_heap(out, out + found, byDistance);
+                    out[found - 1] = {&items[i], &positions[i], d2};
+                    std::push_heap(out, out + found, byDistance);
+                }
+            }
+
+            NodeIndex child = node.firstChild;
+            for (int octant = 0; octant < 8; ++octant) {
+                if (!((node.childMask >> octant) & 1)) continue;
+                Cube cube = getChildCube(next.cube, octant);
+                float d2 = boxDistanceSquared(cube, point);
+                NodeIndex index = child++;
+                if (found == k && d2 >= out[0].distanceSquared) continue;
+                queue.push_back({d2, index, cube});
+                std::push_heap(queue.begin(), queue.end(), byQueueDistance);
+            }
+        }
+
+        std::sort_heap(out, out + found, byDistance);
+        return found;
+    }
+
+    std::vector<Neighbor> nearest(const glm::vec3& point, size_t k) const {
+        SearchScratch scratch;
+        std::vector<Neighbor> out(k);
+        out.resize(nearest(point, k, out.data(), scratch));
+        return out;
+    }
+
+    // k-nearest-neighbour search for many points at once, spread over
+    // threadCount threads (0 = all hardware threads). Neighbours of
+    // points[i] are written to out[i * k, i * k + counts[i]).
+    void nearestBatch(const std::vector<glm::vec3>& points, size_t k,
+                      std::vector<Neighbor>& out, std::vector<uint32_t>& counts,
+                      unsigned threadCount = 0) const {
+        out.resize(points.size() * k);
+        counts.assign(points.size(), 0);
+        const size_t chunkSize = 256;
+        size_t chunks = (points.size() + chunkSize - 1) / chunkSize;
+        parallelFor(chunks, threadCount, [&](size_t chunk) {
+            SearchScratch scratch;
+            size_t last = std::min(points.size(), (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < last; ++i) {
+                counts[i] = static_cast<uint32_t>(
+                    nearest(points[i], k, out.data() + i * k, scratch));
+            }
+        });
+    }
+
+    // Calls visit(const Payload&, const glm::vec3& position, float
+    // distanceSquared) for every item within radius of center, with
+    // references into the tree as queryEach() does. Nodes entirely inside
+    // the sphere are reported without per-point tests.
+    template <typename Visitor>
+    void queryRadius(const glm::vec3& center, float radius,
+                     Visitor&& visit) const {
+        if (radius < 0.0f) return;
+        radiusHelper(kRoot, rootCube, center, radius * radius, visit, false);
+    }
+
+    // Fixed-radius search collecting into out (cleared first). Reusing out
+    // across queries avoids reallocating it.
+    void queryRadius(const glm::vec3& center, float radius,
+                     std::vector<Neighbor>& out) const {
+        out.clear();
+        if (radius < 0.0f) return;
+        auto collect = [&](const Payload& item, const glm::vec3& position,
+                           float d2) { out.push_back({&item, &position, d2}); };
+        radiusHelper(kRoot, rootCube, center, radius * radius, collect, false);
+    }
+
+    // Fixed-radius search for many centers on threadCount threads. out[i]
+    // receives the neighbours of centers[i], in traversal order.
+    void queryRadiusBatch(const std::vector<glm::vec3>& centers, float radius,
+                          std::vector<std::vector<Neighbor>>& out,
+                          unsigned threadCount = 0) const {
+        out.resize(centers.size());
+        parallelFor(centers.size(), threadCount, [&](size_t i) {
+            queryRadius(centers[i], radius, out[i]);
+        });
+    }
+
+    // Writes the tree as an octree section of the on-disk format described
+    // in OctreeFormat.h. Payloads are stored byte for byte.
+    void write(std::ostream& out) const {
+        static_assert(std::is_trivially_copyable<Payload>::value,
+                      "serialized payloads must be trivially copyable");
+
+        OctreeFileHeader header{};
+        header.endianTag = kOctreeEndianTag;
+        header.itemSize = sizeof(Payload);
+        header.rootCenter[0] = rootCube.center.x;
+        header.rootCenter[1] = rootCube.center.y;
+        header.rootCenter[2] = rootCube.center.z;
+        header.rootHalfSize = rootCube.halfSize;
+        header.maxDepth = maxDepth;
+        header.actualMaxDepth = actualMaxDepth;
+        header.leafCapacity = static_cast<uint32_t>(leafCapacity);
+        header.minNodeSize = minNodeSize;
+        // Trees hold fewer than 2^32 items, so larger values all mean the
+        // same
+        header.minPointsPerNode = static_cast<uint32_t>(std::min<size_t>(
+            minPointsPerNode, std::numeric_limits<uint32_t>::max()));
+        header.flags = growRoot ? kOctreeGrowsRoot : 0;
+
+        std::vector<NodeIndex> order;
+        std::vector<NodeIndex> saved;
+        saveOrder(order, saved);
+        header.nodeCount = order.size();
+        header.itemCount = itemCount;
+        header.nodeOffset = sizeof(OctreeFileHeader);
+        header.positionOffset = alignSection(
+            header.nodeOffset + order.size() * sizeof(OctreeNodeRecord));
+        header.itemOffset = alignSection(header.positionOffset +
+                                         itemCount * sizeof(glm::vec3));
+        header.sectionSize =
+            alignSection(header.itemOffset + itemCount * sizeof(Payload));
+
+        std::vector<OctreeNodeRecord> records(order.size());
+        uint32_t firstItem = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Node& node = nodes[order[i]];
+            OctreeNodeRecord& record = records[i];
+            record.firstChild =
+                node.isLeaf() ? kNullNode : saved[node.firstChild];
+            record.firstItem = firstItem;
+            record.itemCount = node.itemCount;
+            record.childMask = node.childMask;
+            firstItem += record.itemCount;
+        }
+
+        uint64_t written = 0;
+        auto writeBytes = [&](const void* bytes, uint64_t size) {
+            out.write(static_cast<const char*>(bytes),
+                      static_cast<std::streamsize>(size));
+            written += size;
+        };
+        auto padTo = [&](uint64_t offset) {
+            static const char zeros[16] = {};
+            writeBytes(zeros, offset - written);
+        };
+
+        writeBytes(&header, sizeof(header));
+        writeBytes(records.data(), records.size() * sizeof(OctreeNodeRecord));
+        padTo(header.positionOffset);
+        for (NodeIndex index : order) {
+            const Node& node = nodes[index];
+            writeBytes(getPositions(node), node.itemCount * sizeof(glm::vec3));
+        }
+        padTo(header.itemOffset);
+        for (NodeIndex index : order) {
+            const Node& node = nodes[index];
+            writeBytes(getItems(node), node.itemCount * sizeof(Payload));
+        }
+        padTo(header.sectionSize);
+
+        if (!out) throw std::runtime_error("Failed to write octree");
+    }
+
+    // Reads a section written by write(). The arena is rebuilt directly from
+    // the node records, so loading costs one pass over the data and no
+    // re-insertion; the item and position sections become the tree's bucket
+    // storage as they are. in must be seekable: nothing is allocated until
+    // the section, which validateHeader() has checked holds every array,
+    // is known to fit in the rest of the stream, so a corrupt header cannot
+    // ask for more memory than the data it comes with. Throws
+    // std::runtime_error on malformed input.
+    static std::unique_ptr<Octree> read(std::istream& in) {
+        static_assert(std::is_trivially_copyable<Payload>::value &&
+                          std::is_default_constructible<Payload>::value,
+                      "serialized payloads must be trivially copyable");
+
+        OctreeFileHeader header;
+        readBytes(in, &header, sizeof(header));
+        validateHeader(header, sizeof(Payload));
+        if (header.sectionSize - sizeof(header) > remainingBytes(in)) {
+            throw std::runtime_error("Octree data is truncated");
+        }
+
+        std::vector<OctreeNodeRecord> records(header.nodeCount);
+        std::vector<glm::vec3> positions(header.itemCount);
+        std::vector<Payload> items(header.itemCount);
+        uint64_t offset = sizeof(header);
+        auto readSection = [&](uint64_t at, void* bytes, uint64_t size) {
+            in.ignore(static_cast<std::streamsize>(at - offset));
+            readBytes(in, bytes, size);
+            offset = at + size;
+        };
+        readSection(header.nodeOffset, records.data(),
+                    records.size() * sizeof(OctreeNodeRecord));
+        readSection(header.positionOffset, positions.data(),
+                    positions.size() * sizeof(glm::vec3));
+        readSection(header.itemOffset, items.data(),
+                    items.size() * sizeof(Payload));
+        in.ignore(static_cast<std::streamsize>(header.sectionSize - offset));
+        validateRecords(records.data(), records.size(), header.itemCount);
+
+        auto tree = std::make_unique<Octree>(
+            glm::vec3(header.rootCenter[0], header.rootCenter[1],
+                      header.rootCenter[2]),
+            header.rootHalfSize, header.maxDepth, header.leafCapacity,
+            header.minNodeSize, (header.flags & kOctreeGrowsRoot) != 0,
+            header.minPointsPerNode);
+        tree->actualMaxDepth = header.actualMaxDepth;
+        tree->itemCount = header.itemCount;
+        tree->nodes.resize(records.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            const OctreeNodeRecord& record = records[i];
+            Node& node = tree->nodes[i];
+            node.firstChild = record.firstChild;
+            node.childMask = static_cast<uint8_t>(record.childMask);
+            node.firstItem = record.firstItem;
+            node.itemCount = record.itemCount;
+            node.itemCapacity = record.itemCount;
+        }
+        tree->bucketItems = std::move(items);
+        tree->bucketPositions = std::move(positions);
+        return tree;
+    }
+
+    // Checks an octree section header against this build. Shared with
+    // readers that use the section in place.
+    static void validateHeader(const OctreeFileHeader& header,
+                               size_t itemSize) {
+        if (header.endianTag != kOctreeEndianTag) {
+            throw std::runtime_error("Octree data has foreign byte order");
+        }
+        if (header.itemSize != itemSize) {
+            throw std::runtime_error("Octree item size mismatch");
+        }
+        if (header.nodeCount == 0 || header.nodeCount >= kNullNode ||
+            header.itemCount >= std::numeric_limits<uint32_t>::max() ||
+            header.sectionSize >= (uint64_t(1) << 62) ||
+            header.nodeOffset > header.sectionSize ||
+            header.positionOffset > header.sectionSize ||
+            header.itemOffset > header.sectionSize) {
+            throw std::runtime_error("Octree size out of range");
+        }
+        uint64_t nodeEnd =
+            header.nodeOffset + header.nodeCount * sizeof(OctreeNodeRecord);
+        uint64_t positionEnd =
+            header.positionOffset + header.itemCount * sizeof(glm::vec3);
+        uint64_t itemEnd = header.itemOffset + header.itemCount * itemSize;
+        if (header.nodeOffset < sizeof(OctreeFileHeader) ||
+            header.positionOffset < nodeEnd ||
+            header.itemOffset < positionEnd || header.sectionSize < itemEnd ||
+            header.nodeOffset % 16 || header.positionOffset % 16 ||
+            header.itemOffset % 16) {
+            throw std::runtime_error("Octree section layout is corrupt");
+        }
+    }
+
+    // Every child run and item range must lie inside the section, and
+    // children must come after their parent so traversals terminate.
+    static void validateRecords(const OctreeNodeRecord* records,
+                                size_t nodeCount, uint64_t itemCount) {
+        for (size_t i = 0; i < nodeCount; ++i) {
+            const OctreeNodeRecord& record = records[i];
+            bool badChild =
+                record.childMask > 0xFF ||
+                (record.firstChild == kNullNode) != (record.childMask == 0) ||
+                (record.firstChild != kNullNode &&
+                 (record.firstChild <= i ||
+                  uint64_t(record.firstChild) + popcount8(record.childMask) >
+                      nodeCount));
+            bool badItems =
+                uint64_t(record.firstItem) + record.itemCount > itemCount;
+            if (badChild || badItems) {
+                throw std::runtime_error("Octree node records are corrupt");
+            }
+        }
+    }
+
+    // Pre-size the node arena when the final tree size can be estimated.
+    void reserveNodes(size_t count) { nodes.reserve(count); }
+
+    const Node* getRoot() const { return &nodes[kRoot]; }
+    NodeIndex getRootIndex() const { return kRoot; }
+    Cube getRootCube() const { return rootCube; }
+    // Cube of the child in octant of a node with cube. Every traversal
+    // derives cubes this way, so they agree bit for bit.
+    static Cube getChildCube(const Cube& cube, int octant) {
+        float childHalfSize = cube.halfSize * 0.5f;
+        return {childCenter(cube.center, childHalfSize, octant),
+                childHalfSize};
+    }
+    const Node& getNode(NodeIndex index) const { return nodes[index]; }
+    // kNullNode for an octant without a child.
+    NodeIndex getChild(const Node& node, int octant) const {
+        return (node.childMask >> octant) & 1 ? childIndex(node, octant)
+                                              : kNullNode;
+    }
+    size_t getItemCount(const Node& node) const { return node.itemCount; }
+    // The node's bucket, getItemCount(node) items and their positions. The
+    // pointers stay valid until the tree is modified.
+    const Payload* getItems(const Node& node) const {
+        return bucketItems.data() + node.firstItem;
+    }
+    const glm::vec3* getPositions(const Node& node) const {
+        return bucketPositions.data() + node.firstItem;
+    }
+    // Nodes in the tree. Arena slots of child runs released by remove() or
+    // outgrown by later inserts, and not yet reused, are not counted.
+    size_t getNodeCount() const {
+        size_t released = 0;
+        for (unsigned n = 1; n <= 8; ++n) {
+            released += n * freeRuns[n - 1].size();
+        }
+        return nodes.size() - released;
+    }
     int getMaxDepth() const { return maxDepth; }
+    size_t getLeafCapacity() const { return leafCapacity; }
+    float getMinNodeSize() const { return minNodeSize; }
+    size_t getMinPointsPerNode() const { return minPointsPerNode; }
+    bool growsRoot() const { return growRoot; }
+    // Whether position lies in the root cube, where every kept point lies.
+    bool inRoot(const glm::vec3& position) const {
+        return contains(rootCube, position);
+    }
     int getActualMaxDepth() const { return actualMaxDepth; }
 
    private:
-    std::unique_ptr<Node> root;
+    static constexpr NodeIndex kRoot = 0;
+
+    std::vector<Node> nodes;
+    // Bucket storage of every node, one slot per item, with the position
+    // each item was inserted with kept in a separate packed array so range
+    // tests never touch the payload. Buckets are blocks of consecutive
+    // slots; a block is moved to a larger one when its bucket outgrows it.
+    std::vector<Payload> bucketItems;
+    std::vector<glm::vec3> bucketPositions;
     int maxDepth;
+    size_t leafCapacity;
+    float minNodeSize;
+    bool growRoot;
+    size_t minPointsPerNode;
+    Cube rootCube;
+    // Deepest level nodes can be created at, from maxDepth and minNodeSize.
+    int depthLimit;
+    // Deepest level reached so far; collapses do not lower it.
     int actualMaxDepth;
+    size_t itemCount;
+    // First index of each released child run, by run length: freeRuns[n - 1]
+    // holds the runs of n nodes. Runs are released by collapses and by
+    // nodes whose children moved to a longer run.
+    std::set<NodeIndex> freeRuns[8];
+    // First slot of each released bucket block, by size class:
+    // freeBlocks[k] holds blocks of at least 2^k slots.
+    std::vector<uint32_t> freeBlocks[32];
 
-    void insertHelper(Node* node, const T& item, const glm::vec3& position,
-                      int depth) {
-        if (!node) return;
+    static constexpr size_t kNoItem = std::numeric_limits<size_t>::max();
 
-        // Update actual max depth
-        actualMaxDepth = std::max(actualMaxDepth, depth);
+    static uint64_t alignSection(uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    // Bytes between the read position of in and its end.
+    static uint64_t remainingBytes(std::istream& in) {
+        const std::istream::pos_type position = in.tellg();
+        if (position == std::istream::pos_type(-1) ||
+            !in.seekg(0, std::ios::end)) {
+            throw std::runtime_error("Octree data stream is not seekable");
+        }
+        const std::istream::pos_type end = in.tellg();
+        in.seekg(position);
+        if (!in || end < position) {
+            throw std::runtime_error("Octree data stream is not seekable");
+        }
+        return static_cast<uint64_t>(end - position);
+    }
+
+    static void readBytes(std::istream& in, void* bytes, uint64_t size) {
+        in.read(static_cast<char*>(bytes), static_cast<std::streamsize>(size));
+        if (!in) throw std::runtime_error("Unexpected end of octree data");
+    }
+
+    static bool contains(const Cube& cube, const glm::vec3& position) {
+        glm::vec3 diff = glm::abs(position - cube.center);
+        return diff.x <= cube.halfSize && diff.y <= cube.halfSize &&
+               diff.z <= cube.halfSize;
+    }
+
+    // A child's edge length equals its parent's halfSize, so the size limit
+    // turns into a depth limit once for the whole tree.
+    void updateDepthLimit() {
+        depthLimit = 0;
+        float childSize = rootCube.halfSize;
+        while (depthLimit < maxDepth && childSize >= minNodeSize) {
+            ++depthLimit;
+            childSize *= 0.5f;
+        }
+    }
+
+    // Grows the root until it contains position, when the tree grows its
+    // root. Returns false, leaving the tree as it was, for a tree that does
+    // not or a non-finite position.
+    bool growToward(const glm::vec3& position) {
+        if (!growRoot || !std::isfinite(position.x) ||
+            !std::isfinite(position.y) || !std::isfinite(position.z)) {
+            return false;
+        }
+        const bool leaf = nodes[kRoot].isLeaf();
+        if (!(rootCube.halfSize > 0.0f)) {
+            // Doubling cannot reach anything, but the cells of a zero-size
+            // root have no size to keep, so the root just takes the size it
+            // needs. Items below a root with children go in again.
+            glm::vec3 diff = glm::abs(position - rootCube.center);
+            Cube cube = {rootCube.center, std::max({diff.x, diff.y, diff.z})};
+            if (leaf) {
+                rootCube = cube;
+                updateDepthLimit();
+            } else {
+                rebuild(cube, 0);
+            }
+            return true;
+        }
+
+        // The old root becomes a cell of the grown one only if the grown
+        // cube's children round back to it exactly; otherwise the cubes
+        // derived below it would drift from those its items were placed by.
+        Cube cube = rootCube;
+        int steps = 0;
+        bool exact = true;
+        while (!contains(cube, position)) {
+            int oldOctant;
+            Cube grown = grownCube(cube, position, oldOctant);
+            Cube kept = getChildCube(grown, oldOctant);
+            exact = exact && kept.center == cube.center &&
+                    kept.halfSize == cube.halfSize;
+            cube = grown;
+            ++steps;
+        }
+        if (leaf || exact) {
+            while (!contains(rootCube, position)) growOnce(position);
+        } else {
+            rebuild(cube, steps);
+        }
+        return true;
+    }
 
-        // Check if point is inside this node
-        glm::vec3 diff = glm::abs(position - node->center);
-        if (diff.x > node->halfSize || diff.y > node->halfSize ||
-            diff.z > node->halfSize) {
-            return;  // Point is outside this node
+    // Grows the root of an empty tree over every finite position, so that
+    // the bulk build keeps them all.
+    void growOver(const std::vector<glm::vec3>& positions) {
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        for (const glm::vec3& position : positions) {
+            if (std::isfinite(position.x) && std::isfinite(position.y) &&
+                std::isfinite(position.z)) {
+                min = glm::min(min, position);
+                max = glm::max(max, position);
+            }
         }
+        if (min.x > max.x) return;
+        growToward(min);
+        growToward(max);
+    }
 
-        // If leaf node or max depth reached, add item here
-        if (depth >= maxDepth || (node->isLeaf() && node->data.size() < 8)) {
-            node->data.push_back(item);
+    // cube with its edge doubled toward position on every axis. The old
+    // cube lies in the opposite octant of the new one, returned in
+    // oldOctant.
+    static Cube grownCube(const Cube& cube, const glm::vec3& position,
+                          int& oldOctant) {
+        Cube grown = {cube.center, 2.0f * cube.halfSize};
+        oldOctant = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (position[axis] < cube.center[axis]) {
+                grown.center[axis] -= cube.halfSize;
+                oldOctant |= 1 << axis;
+            } else {
+                grown.center[axis] += cube.halfSize;
+            }
+        }
+        return grown;
+    }
+
+    // Grows the root once toward position. Under a root with children the
+    // arena shifts by one node, so the old root becomes the new root's only
+    // child at index 1.
+    void growOnce(const glm::vec3& position) {
+        int oldOctant;
+        rootCube = grownCube(rootCube, position, oldOctant);
+        ++maxDepth;
+
+        if (nodes[kRoot].isLeaf()) {
+            updateDepthLimit();
             return;
         }
 
-        // If leaf but full, subdivide
-        if (node->isLeaf() && node->data.size() >= 8) {
-            subdivide(node);
+        for (Node& node : nodes) {
+            if (!node.isLeaf()) ++node.firstChild;
+        }
+        for (std::set<NodeIndex>& runs : freeRuns) {
+            std::set<NodeIndex> shifted;
+            for (NodeIndex run : runs) shifted.insert(shifted.end(), run + 1);
+            runs.swap(shifted);
+        }
+        nodes.insert(nodes.begin() + 1, Node());
+        nodes[1] = std::move(nodes[kRoot]);
+        nodes[kRoot] = Node();
+        nodes[kRoot].firstChild = 1;
+        nodes[kRoot].childMask = static_cast<uint8_t>(1u << oldOctant);
+        ++actualMaxDepth;
+        updateDepthLimit();
+    }
 
-            // Redistribute existing data
-            std::vector<T> oldData = std::move(node->data);
-            for (const auto& oldItem : oldData) {
-                insertHelper(node, oldItem, oldItem.position, depth);
+    // Grows the root to cube, steps doublings away, by inserting every item
+    // again below a fresh root.
+    void rebuild(const Cube& cube, int steps) {
+        std::vector<Payload> data;
+        std::vector<glm::vec3> positions;
+        data.reserve(itemCount);
+        positions.reserve(itemCount);
+        std::vector<NodeIndex> stack(1, kRoot);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            auto first = bucketItems.begin() + node.firstItem;
+            std::move(first, first + node.itemCount, std::back_inserter(data));
+            positions.insert(positions.end(), getPositions(node),
+                             getPositions(node) + node.itemCount);
+            for (unsigned i = node.childCount(); i-- > 0;) {
+                stack.push_back(node.firstChild + i);
             }
         }
 
+        nodes.clear();
+        nodes.emplace_back();
+        bucketItems.clear();
+        bucketPositions.clear();
+        for (std::set<NodeIndex>& runs : freeRuns) runs.clear();
+        for (std::vector<uint32_t>& blocks : freeBlocks) blocks.clear();
+        rootCube = cube;
+        maxDepth += steps;
+        actualMaxDepth += steps;
+        updateDepthLimit();
+        for (size_t i = 0; i < data.size(); ++i) {
+            insertHelper(kRoot, rootCube, data[i], positions[i], 0);
+        }
+    }
+
+    // Center of child octant of a node at center whose children have
+    // childHalfSize.
+    static glm::vec3 childCenter(const glm::vec3& center, float childHalfSize,
+                                 int octant) {
+        glm::vec3 offset;
+        offset.x = ((octant & 1) ? 1 : -1) * childHalfSize;
+        offset.y = ((octant & 2) ? 1 : -1) * childHalfSize;
+        offset.z = ((octant & 4) ? 1 : -1) * childHalfSize;
+        return center + offset;
+    }
+
+    // Node references are not stable across addChildren() because the arena
+    // may grow, so the helpers below work on indices. Containment is only
+    // checked at the root: below it getOctant() decides, so rounding in the
+    // child centers can never drop a point. cube is the node's cube.
+    void insertHelper(NodeIndex index, const Cube& cube, const Payload& item,
+                      const glm::vec3& position, int depth) {
+        if (index == kNullNode) return;
+
+        // Update actual max depth
+        actualMaxDepth = std::max(actualMaxDepth, depth);
+
+        Node& node = nodes[index];
+
+        // If leaf node or depth limit reached, add item here
+        if (depth >= depthLimit ||
+            (node.isLeaf() && node.itemCount < leafCapacity)) {
+            appendItem(index, item, position);
+            return;
+        }
+
+        // If leaf but full, subdivide into the octants its items occupy
+        int octant = getOctant(cube.center, position);
+        if (node.isLeaf()) {
+            splitLeaf(index, cube, depth, 1u << octant);
+        } else {
+            addChildren(index, 1u << octant);
+        }
+
         // Insert into appropriate child
-        int octant = getOctant(node->center, position);
-        insertHelper(node->children[octant].get(), item, position, depth + 1);
+        insertHelper(childIndex(nodes[index], octant),
+                     getChildCube(cube, octant), item, position, depth + 1);
+    }
+
+    // Gives a leaf children in the octants of extraMask and in those its
+    // items occupy, and moves its items down into them.
+    void splitLeaf(NodeIndex index, const Cube& cube, int depth,
+                   unsigned extraMask) {
+        // The block stays reserved until its items are moved out; only
+        // slot indices are used, as appends below may move the storage.
+        Node& node = nodes[index];
+        const uint32_t first = node.firstItem;
+        const uint32_t count = node.itemCount;
+        const uint32_t capacity = node.itemCapacity;
+        node.firstItem = node.itemCount = node.itemCapacity = 0;
+        addChildren(index,
+                    extraMask | octantMask(cube.center,
+                                           bucketPositions.data() + first,
+                                           count));
+
+        // Redistribute existing data
+        for (uint32_t i = first; i < first + count; ++i) {
+            Payload item = std::move(bucketItems[i]);
+            glm::vec3 position = bucketPositions[i];
+            insertHelper(index, cube, item, position, depth);
+        }
+        releaseBlock(first, capacity);
+    }
+
+    void appendItem(NodeIndex index, const Payload& item,
+                    const glm::vec3& position) {
+        Node& node = nodes[index];
+        if (node.itemCount == node.itemCapacity) {
+            reserveItems(index, std::max<size_t>(2 * node.itemCapacity, 1));
+        }
+        const size_t slot = node.firstItem + node.itemCount++;
+        bucketItems[slot] = item;
+        bucketPositions[slot] = position;
+    }
+
+    // Moves the node's bucket to a block of at least capacity slots when
+    // its own is smaller.
+    void reserveItems(NodeIndex index, size_t capacity) {
+        Node& node = nodes[index];
+        if (capacity <= node.itemCapacity) return;
+        uint32_t first = takeBlock(capacity);
+        std::move(bucketItems.begin() + node.firstItem,
+                  bucketItems.begin() + node.firstItem + node.itemCount,
+                  bucketItems.begin() + first);
+        std::copy_n(bucketPositions.begin() + node.firstItem, node.itemCount,
+                    bucketPositions.begin() + first);
+        releaseBlock(node.firstItem, node.itemCapacity);
+        node.firstItem = first;
+        node.itemCapacity = static_cast<uint32_t>(capacity);
     }
 
-    void subdivide(Node* node) {
-        float newHalfSize = node->halfSize * 0.5f;
+    // First slot of a block of at least capacity slots, and its size in
+    // capacity: a released block of the size class that fits when there is
+    // one, else exactly capacity new slots at the end of the storage, which
+    // keeps buckets laid out in one go (build(), read()) packed.
+    uint32_t takeBlock(size_t& capacity) {
+        int sizeClass = ceilLog2(capacity);
+        if (sizeClass < 32 && !freeBlocks[sizeClass].empty()) {
+            uint32_t first = freeBlocks[sizeClass].back();
+            freeBlocks[sizeClass].pop_back();
+            capacity = size_t(1) << sizeClass;
+            return first;
+        }
+        size_t first = bucketItems.size();
+        if (capacity > std::numeric_limits<uint32_t>::max() - first) {
+            throw std::runtime_error("Octree item storage is full");
+        }
+        bucketItems.resize(first + capacity);
+        bucketPositions.resize(first + capacity);
+        return static_cast<uint32_t>(first);
+    }
+
+    // Keeps a block whose items have been moved out for reuse. It serves
+    // requests of up to the largest power of two it holds.
+    void releaseBlock(uint32_t first, uint32_t capacity) {
+        if (capacity > 0) freeBlocks[floorLog2(capacity)].push_back(first);
+    }
+
+    // Smallest k with 2^k >= n.
+    static int ceilLog2(size_t n) {
+        int k = 0;
+        while ((size_t(1) << k) < n) ++k;
+        return k;
+    }
+
+    static int floorLog2(size_t n) {
+        int k = 0;
+        while (n >>= 1) ++k;
+        return k;
+    }
 
-        for (int i = 0; i < 8; ++i) {
-            node->children[i] = std::make_unique<Node>();
-            node->children[i]->halfSize = newHalfSize;
+    // Gives a node children in the octants of mask it has none in yet. The
+    // children it has move to a run of the new length; their own children
+    // stay where they are.
+    void addChildren(NodeIndex index, unsigned mask) {
+        const unsigned oldMask = nodes[index].childMask;
+        const unsigned newMask = oldMask | mask;
+        if (newMask == oldMask) return;
 
-            glm::vec3 offset;
-            offset.x = ((i & 1) ? 1 : -1) * newHalfSize;
-            offset.y = ((i & 2) ? 1 : -1) * newHalfSize;
-            offset.z = ((i & 4) ? 1 : -1) * newHalfSize;
+        NodeIndex firstChild = takeRun(popcount8(newMask));
+        Node& node = nodes[index];
+        const NodeIndex oldFirstChild = node.firstChild;
+        for (int i = 0, rank = 0, oldRank = 0; i < 8; ++i) {
+            if (!((newMask >> i) & 1)) continue;
+            Node& child = nodes[firstChild + rank++];
+            if ((oldMask >> i) & 1) {
+                child = std::move(nodes[oldFirstChild + oldRank++]);
+            }
+        }
+        if (oldMask != 0) releaseRun(oldFirstChild, popcount8(oldMask));
+        node.firstChild = firstChild;
+        node.childMask = static_cast<uint8_t>(newMask);
+    }
 
-            node->children[i]->center = node->center + offset;
+    // First index of count consecutive unused nodes: a released run when
+    // there is one, else new nodes at the end of the arena.
+    NodeIndex takeRun(unsigned count) {
+        std::set<NodeIndex>& runs = freeRuns[count - 1];
+        if (!runs.empty()) {
+            NodeIndex first = *runs.begin();
+            runs.erase(runs.begin());
+            return first;
         }
+        NodeIndex first = static_cast<NodeIndex>(nodes.size());
+        nodes.resize(nodes.size() + count);
+        return first;
+    }
+
+    // Clears a run of nodes, which frees their buckets, and keeps it for
+    // reuse.
+    void releaseRun(NodeIndex first, unsigned count) {
+        for (unsigned i = 0; i < count; ++i) nodes[first + i] = Node();
+        freeRuns[count - 1].insert(first);
     }
 
-    int getOctant(const glm::vec3& center, const glm::vec3& position) const {
+    static NodeIndex childIndex(const Node& node, int octant) {
+        return node.firstChild + childRank(node.childMask, octant);
+    }
+
+    // Octants of a node at center that count positions fall in.
+    static unsigned octantMask(const glm::vec3& center,
+                               const glm::vec3* positions, size_t count) {
+        unsigned mask = 0;
+        for (size_t i = 0; i < count; ++i) {
+            mask |= 1u << getOctant(center, positions[i]);
+        }
+        return mask;
+    }
+
+    // Inserts positions[first, last) through a single descent of their
+    // Morton order. Points outside the root are dropped.
+    template <typename MakeItem>
+    void insertRun(const glm::vec3* positions, size_t first, size_t last,
+                   MakeItem& makeItem) {
+        if (first == last) return;
+        if (depthLimit > kMaxMortonDepth) {
+            for (size_t i = first; i < last; ++i) {
+                insert(makeItem(i), positions[i]);
+            }
+            return;
+        }
+
+        std::vector<MortonEntry> entries;
+        entries.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            if (contains(rootCube, positions[i])) {
+                entries.push_back(
+                    {mortonKey(positions[i], depthLimit), i - first});
+            }
+        }
+        if (entries.empty()) return;
+        radixSortMorton(entries, 3 * depthLimit);
+        itemCount += entries.size();
+
+        auto makeRunItem = [&](size_t i) { return makeItem(first + i); };
+        insertRange(kRoot, rootCube, entries.data(),
+                    entries.data() + entries.size(), 0, positions + first,
+                    makeRunItem);
+    }
+
+    // Adds a Morton-sorted range to the subtree at index, whose cube is
+    // cube, as insertHelper() would add its points one by one in index
+    // order.
+    template <typename MakeItem>
+    void insertRange(NodeIndex index, const Cube& cube, MortonEntry* begin,
+                     MortonEntry* end, int depth, const glm::vec3* positions,
+                     MakeItem& makeItem) {
+        actualMaxDepth = std::max(actualMaxDepth, depth);
+        auto byIndex = [](const MortonEntry& a, const MortonEntry& b) {
+            return a.index < b.index;
+        };
+
+        size_t count = static_cast<size_t>(end - begin);
+        const Node& node = nodes[index];
+        if (depth >= depthLimit ||
+            (node.isLeaf() && node.itemCount + count <= leafCapacity)) {
+            // At the depth limit the keys are all equal and the stable sort
+            // kept index order
+            if (depth < depthLimit) std::sort(begin, end, byIndex);
+            if (node.itemCount == 0) {
+                // Reserving on top of earlier items would defeat the
+                // geometric growth of appendItem() across batches
+                reserveItems(index, count);
+            }
+            for (MortonEntry* entry = begin; entry != end; ++entry) {
+                appendItem(index, Traits::pack(makeItem(entry->index)),
+                           positions[entry->index]);
+            }
+            return;
+        }
+
+        MortonEntry* bounds[9];
+        unsigned mask = splitRange(begin, end, 3 * (depthLimit - depth - 1),
+                                   bounds);
+        if (node.isLeaf()) {
+            // The range overflows the leaf: split it first, so its own items
+            // stay ahead of the new ones in the children
+            splitLeaf(index, cube, depth, mask);
+        } else {
+            addChildren(index, mask);
+        }
+
+        for (int octant = 0; octant < 8; ++octant) {
+            if (bounds[octant] == bounds[octant + 1]) continue;
+            insertRange(childIndex(nodes[index], octant),
+                        getChildCube(cube, octant), bounds[octant],
+                        bounds[octant + 1], depth + 1, positions, makeItem);
+        }
+    }
+
+    // Splits a Morton-sorted range at the octant in bits [shift, shift + 3)
+    // of its keys: octant i gets [bounds[i], bounds[i + 1]). Returns the
+    // octants that get any entries.
+    static unsigned splitRange(MortonEntry* begin, MortonEntry* end,
+                               int shift, MortonEntry* bounds[9]) {
+        unsigned mask = 0;
+        bounds[0] = begin;
+        for (int octant = 0; octant < 8; ++octant) {
+            bounds[octant + 1] = std::partition_point(
+                bounds[octant], end, [&](const MortonEntry& entry) {
+                    return static_cast<int>((entry.key >> shift) & 7) <=
+                           octant;
+                });
+            if (bounds[octant + 1] != bounds[octant]) mask |= 1u << octant;
+        }
+        return mask;
+    }
+
+    static int getOctant(const glm::vec3& center, const glm::vec3& position) {
         int octant = 0;
         if (position.x > center.x) octant |= 1;
         if (position.y > center.y) octant |= 2;
@@ -103,33 +1252,315 @@ class Octree {
         return octant;
     }
 
-    void queryHelper(const Node* node, const glm::vec3& min,
-                     const glm::vec3& max, std::vector<T>& results) const {
-        if (!node) return;
+    // Nodes insert() passes through for position, root first. Items at
+    // position are stored in the last one.
+    void descend(const glm::vec3& position,
+                 std::vector<NodeIndex>& path) const {
+        path.clear();
+        NodeIndex index = kRoot;
+        Cube cube = rootCube;
+        path.push_back(index);
+        for (int depth = 0; depth < depthLimit && !nodes[index].isLeaf();
+             ++depth) {
+            const Node& node = nodes[index];
+            int octant = getOctant(cube.center, position);
+            if (!((node.childMask >> octant) & 1)) break;
+            index = childIndex(node, octant);
+            cube = getChildCube(cube, octant);
+            path.push_back(index);
+        }
+    }
+
+    template <typename Match>
+    size_t findItem(const Node& node, const glm::vec3& position,
+                    Match& match) const {
+        const Payload* items = getItems(node);
+        const glm::vec3* positions = getPositions(node);
+        for (size_t i = 0; i < node.itemCount; ++i) {
+            if (positions[i] == position && match(items[i])) {
+                return i;
+            }
+        }
+        return kNoItem;
+    }
 
-        // Check if query box intersects with node
-        glm::vec3 nodeMin = node->center - glm::vec3(node->halfSize);
-        glm::vec3 nodeMax = node->center + glm::vec3(node->halfSize);
+    // Erases item of the last node on path, then collapses the nodes above
+    // it for as long as they can be.
+    void eraseItem(const std::vector<NodeIndex>& path, size_t item) {
+        Node& node = nodes[path.back()];
+        auto first = bucketItems.begin() + node.firstItem;
+        std::move(first + item + 1, first + node.itemCount, first + item);
+        auto firstPosition = bucketPositions.begin() + node.firstItem;
+        std::copy(firstPosition + item + 1, firstPosition + node.itemCount,
+                  firstPosition + item);
+        if (--node.itemCount == 0) {
+            releaseBlock(node.firstItem, node.itemCapacity);
+            node.firstItem = node.itemCapacity = 0;
+        }
+        --itemCount;
+        for (size_t i = path.size() - 1; i-- > 0;) {
+            if (!collapse(path[i])) break;
+        }
+    }
 
-        if (min.x > nodeMax.x || max.x < nodeMin.x || min.y > nodeMax.y ||
-            max.y < nodeMin.y || min.z > nodeMax.z || max.z < nodeMin.z) {
-            return;  // No intersection
+    // Merges the children of a node back into it when they are all leaves
+    // and their items fit in one leaf, fewer than minPointsPerNode of them.
+    // Their run is released for reuse.
+    bool collapse(NodeIndex index) {
+        Node& node = nodes[index];
+        const unsigned children = node.childCount();
+        size_t count = node.itemCount;
+        for (unsigned i = 0; i < children; ++i) {
+            const Node& child = nodes[node.firstChild + i];
+            if (!child.isLeaf()) return false;
+            count += child.itemCount;
         }
+        if (count > leafCapacity || count >= minPointsPerNode) return false;
 
-        // Add all data in this node that falls within query bounds
-        for (const auto& item : node->data) {
-            if (item.position.x >= min.x && item.position.x <= max.x &&
-                item.position.y >= min.y && item.position.y <= max.y &&
-                item.position.z >= min.z && item.position.z <= max.z) {
-                results.push_back(item);
+        reserveItems(index, count);
+        for (unsigned i = 0; i < children; ++i) {
+            const Node& child = nodes[node.firstChild + i];
+            auto first = bucketItems.begin() + child.firstItem;
+            std::move(first, first + child.itemCount,
+                      bucketItems.begin() + node.firstItem + node.itemCount);
+            std::copy_n(bucketPositions.begin() + child.firstItem,
+                        child.itemCount,
+                        bucketPositions.begin() + node.firstItem +
+                            node.itemCount);
+            node.itemCount += child.itemCount;
+            releaseBlock(child.firstItem, child.itemCapacity);
+        }
+        releaseRun(node.firstChild, children);
+        node.firstChild = kNullNode;
+        node.childMask = 0;
+        return true;
+    }
+
+    // Arena indices of the nodes write() saves, in order, and the saved
+    // index of each arena node. The live nodes are renumbered breadth first,
+    // which leaves released runs out and puts every child run after its
+    // parent, as the format requires, even where a run moved to an earlier
+    // free slot than its children.
+    void saveOrder(std::vector<NodeIndex>& order,
+                   std::vector<NodeIndex>& saved) const {
+        order.clear();
+        saved.assign(nodes.size(), kNullNode);
+        order.push_back(kRoot);
+        saved[kRoot] = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const Node& node = nodes[order[i]];
+            for (unsigned c = 0; c < node.childCount(); ++c) {
+                saved[node.firstChild + c] =
+                    static_cast<NodeIndex>(order.size());
+                order.push_back(node.firstChild + c);
             }
         }
+    }
 
-        // Recursively query children
-        if (!node->isLeaf()) {
-            for (const auto& child : node->children) {
-                queryHelper(child.get(), min, max, results);
+    // Octant path of position over the first `depth` levels. Child cubes
+    // come from getChildCube(), so the key agrees with the descent
+    // insertHelper() would take.
+    uint64_t mortonKey(const glm::vec3& position, int depth) const {
+        Cube cube = rootCube;
+        uint64_t key = 0;
+        for (int level = 0; level < depth; ++level) {
+            int octant = getOctant(cube.center, position);
+            key = (key << 3) | static_cast<uint64_t>(octant);
+            cube = getChildCube(cube, octant);
+        }
+        return key;
+    }
+
+    std::vector<MortonEntry> computeKeys(
+        const std::vector<glm::vec3>& positions, int keyDepth,
+        unsigned threadCount) const {
+        constexpr uint64_t kOutside = ~uint64_t(0);
+        std::vector<MortonEntry> entries(positions.size());
+        const size_t chunkSize = 1 << 16;
+        size_t chunks = (positions.size() + chunkSize - 1) / chunkSize;
+        parallelFor(chunks, threadCount, [&](size_t chunk) {
+            size_t first = chunk * chunkSize;
+            size_t last = std::min(first + chunkSize, positions.size());
+            for (size_t i = first; i < last; ++i) {
+                entries[i].index = i;
+                entries[i].key = contains(rootCube, positions[i])
+                                     ? mortonKey(positions[i], keyDepth)
+                                     : kOutside;
             }
+        });
+
+        // Keys use at most 63 bits, so kOutside only marks dropped points.
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [](const MortonEntry& entry) {
+                                         return entry.key == kOutside;
+                                     }),
+                      entries.end());
+        return entries;
+    }
+
+    // A sorted range whose subtree is built separately by the parallel build.
+    struct BuildTask {
+        NodeIndex index;
+        Cube cube;
+        MortonEntry* begin;
+        MortonEntry* end;
+        int depth;
+    };
+
+    // Moves a separately built subtree into this arena, replacing the node
+    // at index with the subtree's root.
+    void stitch(NodeIndex index, Octree& subtree) {
+        actualMaxDepth = std::max(actualMaxDepth, subtree.actualMaxDepth);
+
+        // Subtree node i > 0 lands at offset + i, and its bucket slots
+        // follow this tree's.
+        NodeIndex offset = static_cast<NodeIndex>(nodes.size()) - 1;
+        size_t itemOffset = bucketItems.size();
+        if (subtree.bucketItems.size() >
+            std::numeric_limits<uint32_t>::max() - itemOffset) {
+            throw std::runtime_error("Octree item storage is full");
+        }
+        for (Node& node : subtree.nodes) {
+            if (!node.isLeaf()) node.firstChild += offset;
+            node.firstItem += static_cast<uint32_t>(itemOffset);
+        }
+        bucketItems.insert(
+            bucketItems.end(),
+            std::make_move_iterator(subtree.bucketItems.begin()),
+            std::make_move_iterator(subtree.bucketItems.end()));
+        bucketPositions.insert(bucketPositions.end(),
+                               subtree.bucketPositions.begin(),
+                               subtree.bucketPositions.end());
+        nodes[index] = std::move(subtree.nodes[kRoot]);
+        nodes.insert(nodes.end(),
+                     std::make_move_iterator(subtree.nodes.begin() + 1),
+                     std::make_move_iterator(subtree.nodes.end()));
+    }
+
+    // Lays out the subtree for a Morton-sorted range. A node splits exactly
+    // when the incremental build would have split it: above the depth limit
+    // and holding more than the leaf capacity. Ranges reaching taskDepth are
+    // handed back through tasks instead of being built here.
+    template <typename MakeItem>
+    void buildRange(NodeIndex index, const Cube& cube, MortonEntry* begin,
+                    MortonEntry* end, int depth, int keyDepth,
+                    const std::vector<glm::vec3>& positions, MakeItem& makeItem,
+                    int taskDepth = -1,
+                    std::vector<BuildTask>* tasks = nullptr) {
+        if (depth == taskDepth) {
+            tasks->push_back({index, cube, begin, end, depth});
+            return;
+        }
+
+        actualMaxDepth = std::max(actualMaxDepth, depth);
+        size_t count = static_cast<size_t>(end - begin);
+
+        if (depth >= depthLimit || count <= leafCapacity) {
+            // Leaves keep insertion order. At the depth limit all keys in the
+            // range are equal and the stable sort already preserved it.
+            if (depth < depthLimit) {
+                std::sort(begin, end,
+                          [](const MortonEntry& a, const MortonEntry& b) {
+                              return a.index < b.index;
+                          });
+            }
+            reserveItems(index, count);
+            for (MortonEntry* entry = begin; entry != end; ++entry) {
+                appendItem(index, Traits::pack(makeItem(entry->index)),
+                           positions[entry->index]);
+            }
+            return;
+        }
+
+        MortonEntry* bounds[9];
+        addChildren(index, splitRange(begin, end, 3 * (keyDepth - depth - 1),
+                                      bounds));
+        for (int octant = 0; octant < 8; ++octant) {
+            if (bounds[octant] == bounds[octant + 1]) continue;
+            buildRange(childIndex(nodes[index], octant),
+                       getChildCube(cube, octant), bounds[octant],
+                       bounds[octant + 1], depth + 1, keyDepth, positions,
+                       makeItem, taskDepth, tasks);
+        }
+    }
+
+    static float paddedHalfSize(const Cube& cube) {
+        return ::paddedHalfSize(cube.center, cube.halfSize);
+    }
+
+    // Lower bound on the squared distance from point to anything stored
+    // in cube.
+    static float boxDistanceSquared(const Cube& cube, const glm::vec3& point) {
+        glm::vec3 outside = glm::max(
+            glm::abs(point - cube.center) - glm::vec3(paddedHalfSize(cube)),
+            glm::vec3(0.0f));
+        return glm::dot(outside, outside);
+    }
+
+    // Upper bound on the squared distance from point to anything stored
+    // in cube.
+    static float farCornerDistanceSquared(const Cube& cube,
+                                          const glm::vec3& point) {
+        glm::vec3 far =
+            glm::abs(point - cube.center) + glm::vec3(paddedHalfSize(cube));
+        return glm::dot(far, far);
+    }
+
+    template <typename Visitor>
+    void radiusHelper(NodeIndex index, const Cube& cube,
+                      const glm::vec3& center, float radiusSquared,
+                      Visitor& visit, bool inside) const {
+        const Node& node = nodes[index];
+        if (!inside) {
+            if (boxDistanceSquared(cube, center) > radiusSquared) return;
+            inside = farCornerDistanceSquared(cube, center) <= radiusSquared;
+        }
+
+        const Payload* items = getItems(node);
+        const glm::vec3* positions = getPositions(node);
+        for (size_t i = 0; i < node.itemCount; ++i) {
+            glm::vec3 diff = positions[i] - center;
+            float d2 = glm::dot(diff, diff);
+            if (inside || d2 <= radiusSquared) {
+                visit(items[i], positions[i], d2);
+            }
+        }
+
+        NodeIndex child = node.firstChild;
+        for (int octant = 0; octant < 8; ++octant) {
+            if (!((node.childMask >> octant) & 1)) continue;
+            radiusHelper(child++, getChildCube(cube, octant), center,
+                         radiusSquared, visit, inside);
+        }
+    }
+
+    // Once a node is known to lie inside the query box its whole subtree is
+    // reported without further intersection or per-point tests.
+    template <typename Visitor>
+    void queryHelper(NodeIndex index, const Cube& cube, const glm::vec3& min,
+                     const glm::vec3& max, Visitor& visit, bool inside) const {
+        if (index == kNullNode) return;
+        const Node& node = nodes[index];
+
+        if (!inside) {
+            // Check if query box intersects with node
+            if (!cubeIntersectsBox(cube.center, cube.halfSize, min, max)) {
+                return;  // No intersection
+            }
+            inside = cubeInsideBox(cube.center, cube.halfSize, min, max);
+        }
+
+        if (node.itemCount > 0) {
+            visit(getItems(node), getPositions(node), size_t(node.itemCount),
+                  inside);
+        }
+
+        // Recursively query children
+        NodeIndex child = node.firstChild;
+        for (int octant = 0; octant < 8; ++octant) {
+            if (!((node.childMask >> octant) & 1)) continue;
+            queryHelper(child++, getChildCube(cube, octant), min, max, visit,
+                        inside);
         }
     }
 };
@@ -1,14 +1,51 @@
 #pragma once
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
 #include "IModelCompressor.h"
+#include "Octree.h"
+#include "PointCloudCodec.h"
+#include "VertexData.h"
 
 class OctreeCompressor : public IModelCompressor {
    public:
     struct Settings {
         int maxDepth;
+        // A leaf splits once it holds more points than this.
+        int leafCapacity;
+        // Removing or moving points merges a node's children back into it
+        // once they are all leaves holding fewer points than this together,
+        // and no more than leafCapacity (see Octree).
         int minPointsPerNode;
+        // Nodes are never split into children with a smaller edge length.
+        // It is in model units, so it is off (0) by default: any fixed
+        // length would stop small models short of maxDepth.
         float minNodeSize;
+        // Threads used to build the octree; 0 uses every hardware thread.
+        unsigned threadCount;
+        // Grow the octree root to take points pushed outside the bounds of
+        // a session instead of dropping them (see Octree). A grown tree is
+        // deeper, and its stream keeps the cell size of the first root.
+        bool growRoot;
+        // Also produce the compact PointCloudCodec stream, quantised to the
+        // maxDepth grid. Off by default, as encoding costs about as much as
+        // building the tree; a model without one encodes it with the
+        // default options when first asked (see
+        // CompressedModel::getEncodedStream).
+        bool encodeStream;
+        // Entropy coding of each part of that stream, its color quality,
+        // subtree level and encoding threads (see PointCloudCodec::Options).
+        PointCloudCodec::Options streamOptions;
 
-        Settings() : maxDepth(8), minPointsPerNode(10), minNodeSize(0.01f) {}
+        Settings()
+            : maxDepth(8),
+              leafCapacity(8),
+              minPointsPerNode(10),
+              minNodeSize(0.0f),
+              threadCount(1),
+              growRoot(false),
+              encodeStream(false) {}
     };
 
     explicit OctreeCompressor(const Settings& settings);
@@ -16,6 +53,36 @@ class OctreeCompressor : public IModelCompressor {
 
     std::unique_ptr<CompressedModel> compress(const Model& model) override;
 
+    // Streaming session for clouds that arrive in chunks, such as files
+    // larger than memory: begin() with bounds holding every point to come,
+    // push() each chunk, then finish(). Each chunk goes straight into the
+    // octree as one batch (see Octree::insertBatch), so only the tree and
+    // the chunk being pushed are held; points outside the bounds are
+    // dropped unless settings.growRoot is set. begin() without bounds needs
+    // no pass over the data first: the root is sized from the first chunk
+    // and grows to take every later point. The encoded stream is made from
+    // the tree at finish(), which returns nullptr when no point was kept.
+    // begin() discards any unfinished session; push() and finish() throw
+    // std::runtime_error without one.
+    void begin(const glm::vec3& minBounds, const glm::vec3& maxBounds);
+    void begin();
+    void push(const glm::vec3* positions, const glm::vec3* colors,
+              size_t count);
+    void push(const std::vector<glm::vec3>& positions,
+              const std::vector<glm::vec3>& colors);
+    std::unique_ptr<CompressedModel> finish();
+
    private:
+    std::unique_ptr<Octree<VertexData>> makeOctree(const glm::vec3& minBounds,
+                                                   const glm::vec3& maxBounds,
+                                                   bool growRoot) const;
+
     Settings settings;
+
+    // Session in progress, its tree once there is one, and the bounds of
+    // the points it kept
+    bool sessionOpen = false;
+    std::unique_ptr<Octree<VertexData>> session;
+    glm::vec3 sessionMin;
+    glm::vec3 sessionMax;
 };
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+
+// On-disk layout of a saved CompressedModel:
+//
+//   CompressedModelFileHeader
+//   OctreeFileHeader                 (octree section, 16-byte aligned)
+//   OctreeNodeRecord[nodeCount]      at section + nodeOffset
+//   glm::vec3 positions[itemCount]   at section + positionOffset
+//   Payload items[itemCount]         at section + itemOffset
+//
+// Records are written in host byte order; kOctreeEndianTag lets a reader
+// reject files written on a machine with the other byte order. Every array
+// starts on a 16-byte boundary, so a mapped file can be used in place.
+// Items are stored as their OctreeItemTraits payload, which for VertexData
+// is the color alone. Readers accept kCompressedModelVersion only.
+
+constexpr char kCompressedModelMagic[4] = {'O', 'C', 'T', 'C'};
+constexpr uint32_t kCompressedModelVersion = 5;
+constexpr uint32_t kOctreeEndianTag = 0x01020304;
+
+struct CompressedModelFileHeader {
+    char magic[4];
+    uint32_t version;
+    float minBounds[3];
+    float maxBounds[3];
+};
+
+struct OctreeFileHeader {
+    uint32_t endianTag;
+    uint32_t itemSize;
+    float rootCenter[3];
+    float rootHalfSize;
+    int32_t maxDepth;
+    int32_t actualMaxDepth;
+    uint32_t leafCapacity;
+    float minNodeSize;
+    uint64_t nodeCount;
+    uint64_t itemCount;
+    // Byte offsets from the start of this header
+    uint64_t nodeOffset;
+    uint64_t positionOffset;
+    uint64_t itemOffset;
+    // Total size of the section, header included
+    uint64_t sectionSize;
+    // kOctree* flags
+    uint32_t flags;
+    uint32_t minPointsPerNode;
+};
+
+// The tree grows its root to take points outside it
+constexpr uint32_t kOctreeGrowsRoot = 1;
+
+// Items of a node are items[firstItem, firstItem + itemCount). A node has
+// children only in the octants set in childMask; they are consecutive
+// records in octant order starting at firstChild, which is UINT32_MAX for a
+// leaf. Node cubes are not stored: they follow from the root cube in the
+// header and the octants on the way down, as Octree::getChildCube() derives
+// them.
+struct OctreeNodeRecord {
+    uint32_t firstChild;
+    uint32_t firstItem;
+    uint32_t itemCount;
+    uint32_t childMask;
+};
+
+inline unsigned popcount8(unsigned v) {
+    v = v - ((v >> 1) & 0x55);
+    v = (v & 0x33) + ((v >> 2) & 0x33);
+    return (v + (v >> 4)) & 0x0F;
+}
+
+// Index of octant's child among the occupied children of mask.
+inline unsigned childRank(unsigned mask, unsigned octant) {
+    return popcount8(mask & ((1u << octant) - 1));
+}
+
+static_assert(sizeof(CompressedModelFileHeader) % 16 == 0,
+              "octree section must stay 16-byte aligned");
+static_assert(sizeof(OctreeFileHeader) % 16 == 0,
+              "node records must stay 16-byte aligned");
+static_assert(sizeof(OctreeNodeRecord) == 16, "unexpected node record size");
@@ -0,0 +1,18 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// How Octree<T> stores its items. The tree keeps the position of every item
+// in a packed column of its own, so an item type that also carries its
+// position would store it twice. Such a type specialises OctreeItemTraits
+// to store only the rest of it as Payload, and to rebuild the item from a
+// payload and its position. Buckets, and octree sections on disk, hold
+// payloads. By default the payload is the item itself.
+template <typename T>
+struct OctreeItemTraits {
+    using Payload = T;
+
+    static const Payload& pack(const T& item) { return item; }
+    static const T& unpack(const Payload& payload, const glm::vec3&) {
+        return payload;
+    }
+};
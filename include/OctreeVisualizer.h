@@ -2,6 +2,7 @@
 #include <glm/glm.hpp>
 #include <vector>
 
+#include "MappedOctree.h"
 #include "Octree.h"
 #include "VertexData.h"
 
@@ -19,6 +20,8 @@ class OctreeVisualizer {
     // Extract bounding boxes from octree up to specified level
     std::vector<BoundingBox> extractBoundingBoxes(
         const Octree<VertexData>* octree, int maxLevel = -1) const;
+    std::vector<BoundingBox> extractBoundingBoxes(
+        const MappedOctree<VertexData>* octree, int maxLevel = -1) const;
 
     // Get wireframe vertices for a bounding box
     std::vector<glm::vec3> getWireframeVertices(const BoundingBox& box) const;
@@ -27,7 +30,12 @@ class OctreeVisualizer {
     std::vector<glm::vec3> getSolidBoxVertices(const BoundingBox& box) const;
 
    private:
-    void extractBoxesRecursive(const typename Octree<VertexData>::Node* node,
+    // Shared by both octree kinds, which expose the same traversal surface.
+    // cube is the node's cube, which nodes do not store.
+    template <typename Tree>
+    void extractBoxesRecursive(const Tree& octree,
+                               typename Tree::NodeIndex index,
+                               const typename Tree::Cube& cube,
                                std::vector<BoundingBox>& boxes,
                                int currentLevel, int maxLevel) const;
 };
@@ -0,0 +1,51 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 0 means "use every hardware thread".
+inline unsigned resolveThreadCount(unsigned threadCount) {
+    if (threadCount != 0) return threadCount;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs fn(i) for every i in [0, count) on a pool of up to threadCount worker
+// threads. Indices are handed out one at a time, so uneven tasks balance
+// themselves. The first exception thrown by a task is rethrown here once all
+// workers have stopped.
+template <typename Fn>
+void parallelFor(size_t count, unsigned threadCount, Fn&& fn) {
+    threadCount = resolveThreadCount(threadCount);
+    size_t workerCount = std::min<size_t>(threadCount, count);
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount - 1);
+    for (size_t i = 1; i < workerCount; ++i) workers.emplace_back(worker);
+    worker();
+    for (auto& thread : workers) thread.join();
+
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StreamCodec.h"
+
+class Model;
+template <typename T>
+class Octree;
+template <typename T>
+class MappedOctree;
+struct VertexData;
+
+// Compact transfer/storage encoding of a point cloud.
+//
+// Positions are quantised to a 2^depth grid over the root cube and the
+// occupied cells are described by a full octree walked breadth first: one
+// 8-bit child-occupancy code per internal node (bit i set when octant i is
+// occupied, same numbering as Octree). Each code is one rANS symbol (see
+// Rans.h) under a static table picked by how many of the node's six face
+// neighbours at the same depth are occupied, or the codes are stored as
+// they are. Leaves at the grid depth carry a point count for duplicate
+// cells. Colors are either stored per
+// point in leaf order, quantised to 8 bits per channel, or transform coded:
+// the mean YCoCg color of each leaf cell goes through the RAHT (see Raht.h)
+// and the coefficients are quantised with a step set by the color quality.
+// Byte streams are entropy coded with the StreamCodec chosen for each of
+// them.
+//
+// Decoded positions are cell centers, so every point comes back within half
+// a leaf cell per axis, in Morton order rather than input order. With
+// transform coded colors, points sharing a cell share its mean color.
+//
+// Levels are stored coarsest first, each level's occupancy codes and RAHT
+// coefficients together, so a prefix of the stream decodes to a coarser
+// cloud (see decodeLevel). The tree is also cut at subtreeLevel: below the
+// cut every occupied cell roots a subtree coded on its own, whose share of
+// each level is a piece stored with that level, and a table of piece sizes
+// per level lets a decode seek past the subtrees it does not need (see
+// decodeRegion). Being independent, subtrees are also coded and decoded
+// in parallel. The cut thus sets how finely a stream is seekable and how
+// many parts it codes in parallel, not how far it decodes from a prefix.
+// Each kind of subtree section is stored, or
+// rANS coded with one table shared by all subtrees whichever rANS coding
+// was chosen for it, as a single subtree's share is too short to carry or
+// learn statistics of its own. Neighbours outside a subtree do not count
+// towards its contexts. A subtree's transform starts from the low-pass
+// value of its root, which the coefficients above the cut carry, so the
+// coefficients are those of one transform over the whole tree. The
+// transform weights cells by splitting each parent's weight evenly among
+// its occupied children rather than by point count, which makes them known
+// from the levels above.
+//
+// Stream layout (little endian):
+//
+//   "OCTG"  u32 version  u8 depth
+//   f32 center[3]  f32 halfSize  u64 pointCount
+//   u8 occupancy tables: 0 = one per neighbour count (7), 1 = one
+//   u8 color mode: 0 = RGB8, 1 = RAHT  [RAHT: f32 step]
+//   u8 subtreeLevel, 1 to depth
+//   occupancy codes: u8 0 = stored, 1 = rANS  [rANS: the tables]
+//   per level above subtreeLevel, level 0 first:
+//     block: occupancy codes of the level's nodes, stored or rANS coded
+//     RAHT: coded stream: quantised coefficients splitting the level's
+//           cells (level 0 also the DC term), zigzag varint, all Y values,
+//           then all Co, then all Cg
+//   subtreeLevel == depth:
+//     coded stream: leaf point counts minus one, varint
+//     RGB8: coded stream: RGB8 per point
+//   otherwise:
+//     per other section that subtrees have (point counts, RAHT
+//     coefficients, RGB8 colors; in that order):
+//       u8 0 = stored, 1 = rANS  [rANS: table shared by all subtrees]
+//     per level below subtreeLevel, level subtreeLevel first, then the
+//     leaves:
+//       block: byte size of each piece, varint, in Morton order of the
+//              subtree roots, each subtree's geometry piece then its
+//              attribute piece
+//       the pieces, in the same order
+//
+//   Each subtree codes its geometry (occupancy codes, then point counts)
+//   and its attributes (RAHT coefficients, then RGB8 colors) in one rANS
+//   payload each, cut into pieces: one per level, holding that level's
+//   occupancy codes or the coefficients splitting its cells, and one for
+//   the leaves, holding the point counts or RGB8 colors. The first piece
+//   of a payload also holds the lane states. Varint sections are coded in
+//   batches of as many bytes as varints are still unfinished. When a
+//   section of the payload is stored, every piece starts with the varint
+//   size of its rANS part and ends with its stored sections.
+//
+// where a block is a u64 byte length followed by its bytes, and a coded
+// stream is a u8 StreamCoding followed by a block in that coding.
+class PointCloudCodec {
+   public:
+    static constexpr uint32_t kVersion = 8;
+
+    struct Options {
+        // rANS code occupancy codes with a table per neighbour count;
+        // otherwise code them with one table, or store them when
+        // occupancyCoding is Raw.
+        bool contextOccupancy;
+        StreamCoding occupancyCoding;
+        StreamCoding countCoding;
+        StreamCoding colorCoding;
+        // 0-100. Below 100 colors are RAHT coded with a quantisation step of
+        // 2^((100 - quality) / 16) on the 0-255 scale, doubled for
+        // chroma; 100 keeps exact 8-bit colors per point.
+        int colorQuality;
+        // Level whose cells root the independently coded subtrees, clamped
+        // to [1, depth]. Deeper cuts give decodeRegion and the coding
+        // threads more and smaller subtrees, but cost ratio, as neighbours
+        // across subtrees are unseen and each subtree carries its own rANS
+        // states. Every level decodes from a prefix whatever the cut.
+        // depth itself writes no subtrees: decodeRegion decodes everything
+        // and decoding runs on one thread.
+        int subtreeLevel;
+        // Threads that code subtrees; 0 uses every hardware thread. The
+        // stream is the same for any count.
+        unsigned threadCount;
+
+        Options()
+            : contextOccupancy(true),
+              occupancyCoding(StreamCoding::RansStatic),
+              countCoding(StreamCoding::RansAdaptive),
+              colorCoding(StreamCoding::RansAdaptive),
+              colorQuality(75),
+              subtreeLevel(3),
+              threadCount(1) {}
+    };
+
+    static std::vector<uint8_t> encode(const Model& model,
+                                       const glm::vec3& center,
+                                       float halfSize, int depth,
+                                       const Options& options = Options());
+    // Encodes the points held in an octree over its root cube, reading them
+    // in place.
+    static std::vector<uint8_t> encode(const Octree<VertexData>& tree,
+                                       int depth,
+                                       const Options& options = Options());
+    static std::vector<uint8_t> encode(const MappedOctree<VertexData>& tree,
+                                       int depth,
+                                       const Options& options = Options());
+
+    // Out-of-core encoding of clouds larger than memory straight to a file.
+    // Pushed points are keyed on arrival and sorted externally within
+    // memoryLimit bytes, spilling sorted runs to temporary files in
+    // tempDirectory (see ExternalSort.h). finish() merges the runs in one
+    // sequential pass that codes each subtree as its points come out, then
+    // writes the file. Besides the sort, memory holds the levels above the
+    // subtree level and the points of one subtree, so the subtree level
+    // should grow with the cloud; at the grid depth the leaf data of the
+    // whole cloud is held. The file holds the stream encode() makes of the
+    // same points. Throws std::runtime_error when a file cannot be written.
+    class FileEncoder {
+       public:
+        FileEncoder(const std::string& filename, const glm::vec3& center,
+                    float halfSize, int depth,
+                    const Options& options = Options(),
+                    size_t memoryLimit = size_t(256) << 20,
+                    const std::string& tempDirectory = "");
+        ~FileEncoder();
+
+        void push(const glm::vec3* positions, const glm::vec3* colors,
+                  size_t count);
+        void push(const std::vector<glm::vec3>& positions,
+                  const std::vector<glm::vec3>& colors);
+        // Writes the file. Pushing or finishing again afterwards throws.
+        void finish();
+
+       private:
+        struct State;
+        std::unique_ptr<State> state;
+    };
+
+    // Subtrees are decoded on threadCount threads (0 = all hardware
+    // threads) into the same model for any count. Throws
+    // std::runtime_error on malformed input.
+    static std::unique_ptr<Model> decode(const uint8_t* data, size_t size,
+                                         unsigned threadCount = 1);
+    static std::unique_ptr<Model> decode(const std::vector<uint8_t>& stream,
+                                         unsigned threadCount = 1) {
+        return decode(stream.data(), stream.size(), threadCount);
+    }
+
+    // The points decode() returns, with colors left empty. Subtrees code
+    // their colors apart from their geometry, so color sections are not
+    // decoded, nor checked. Throws std::runtime_error on malformed input.
+    static std::unique_ptr<Model> decodePositions(const uint8_t* data,
+                                                  size_t size,
+                                                  unsigned threadCount = 1);
+    static std::unique_ptr<Model> decodePositions(
+        const std::vector<uint8_t>& stream, unsigned threadCount = 1) {
+        return decodePositions(stream.data(), stream.size(), threadCount);
+    }
+
+    // Coarse cloud with one point per occupied cell at `level` (0 = root),
+    // at the cell's center with the cell's mean color. Levels at or past
+    // the grid depth decode everything. With RAHT colors only the first
+    // levelSize(level) bytes are read and the rest may be missing; RGB8
+    // colors need the whole stream. Throws std::runtime_error on malformed
+    // input.
+    static std::unique_ptr<Model> decodeLevel(const uint8_t* data,
+                                              size_t size, int level,
+                                              unsigned threadCount = 1);
+    static std::unique_ptr<Model> decodeLevel(
+        const std::vector<uint8_t>& stream, int level,
+        unsigned threadCount = 1) {
+        return decodeLevel(stream.data(), stream.size(), level, threadCount);
+    }
+    // Bytes at the start of a RAHT-colored stream that decodeLevel(level)
+    // reads. Finding out needs only those bytes. Past the subtree level
+    // the pieces of every subtree down to level are read, so this grows
+    // with level rather than jumping to the whole stream.
+    static size_t levelSize(const uint8_t* data, size_t size, int level);
+
+    // The points inside the box [min, max], decoding only the subtrees
+    // whose cells meet it. Throws std::runtime_error on malformed input.
+    static std::unique_ptr<Model> decodeRegion(const uint8_t* data,
+                                               size_t size,
+                                               const glm::vec3& min,
+                                               const glm::vec3& max,
+                                               unsigned threadCount = 1);
+    static std::unique_ptr<Model> decodeRegion(
+        const std::vector<uint8_t>& stream, const glm::vec3& min,
+        const glm::vec3& max, unsigned threadCount = 1) {
+        return decodeRegion(stream.data(), stream.size(), min, max,
+                            threadCount);
+    }
+
+    static bool isEncodedFile(const std::string& filename);
+    static void writeFile(const std::vector<uint8_t>& stream,
+                          const std::string& filename);
+    static std::vector<uint8_t> readFile(const std::string& filename);
+};
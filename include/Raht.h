@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Region-Adaptive Hierarchical Transform of three-channel attributes over
+// the occupied cells of an octree.
+//
+// Cells are given by their Morton keys (sorted, unique, 3 * depth bits) and
+// positive weights, such as the number of points each one stands for, whose
+// sum must fit in 64 bits. The transform merges cells one key bit at a time,
+// finest first, so each octree level is three steps along x, y and z. Two
+// cells whose keys differ only in the current bit, with weights w1, w2 and
+// attributes A1, A2 scaled by sqrt(w), become
+//
+//   L = a A1 + b A2,  H = -b A1 + a A2,  a = sqrt(w1 / w), b = sqrt(w2 / w)
+//
+// with w = w1 + w2. L moves up with weight w and H is a coefficient; a cell
+// without a partner moves up unchanged. The transform is orthonormal, so a
+// uniform quantiser gives every coefficient the same error, and most H
+// terms of smooth attributes are near zero.
+//
+// Coefficients are ordered coarse to fine: the root's L (the DC term), then
+// the H terms of each step from the last to the first, each step in key
+// order, three channels per coefficient. There are as many coefficients as
+// cells. The steps of the top L octree levels only see the cells at level L
+// with their summed weights, so the first coefficients of a transform are
+// the whole transform of that coarser tree: inverse() of them over the
+// level-L cells gives the cells' weighted means.
+class Raht {
+   public:
+    static constexpr int kChannels = 3;
+
+    // attributes holds kChannels values per cell; returns kChannels values
+    // per coefficient.
+    static std::vector<double> forward(const std::vector<uint64_t>& keys,
+                                       const std::vector<uint64_t>& weights,
+                                       int depth,
+                                       const std::vector<double>& attributes);
+
+    static std::vector<double> inverse(const std::vector<uint64_t>& keys,
+                                       const std::vector<uint64_t>& weights,
+                                       int depth,
+                                       const std::vector<double>& coefficients);
+};
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ByteStream.h"
+
+// Byte-oriented rANS with kRansLanes interleaved 32-bit states and 16-bit
+// renormalisation. Symbol i belongs to lane i % kRansLanes, so a decoder
+// can advance all lanes at once: one table gather, one multiply-add and at
+// most one 16-bit read per lane. With AVX2 that is a single 8-wide step;
+// otherwise the same loop runs lane by lane.
+
+constexpr int kRansScaleBits = 12;
+constexpr uint32_t kRansScale = 1u << kRansScaleBits;
+constexpr int kRansLanes = 8;
+
+// Quantised byte frequencies summing to at most kRansScale. Every present
+// symbol has a frequency in [1, kRansScale - 1].
+class RansTable {
+   public:
+    // Scales counts (zero for absent symbols) to table frequencies.
+    static RansTable fromCounts(const uint32_t counts[256]);
+
+    void write(ByteWriter& out) const;
+    // Throws std::runtime_error on an invalid table.
+    static RansTable read(ByteReader& in);
+
+    uint32_t frequency(uint8_t symbol) const { return freq[symbol]; }
+    uint32_t start(uint8_t symbol) const { return cumulative[symbol]; }
+
+    // Decode entry for a slot in [0, kRansScale): frequency in bits 0-11,
+    // slot minus symbol start in bits 12-23, symbol in bits 24-31. Slots
+    // past the last symbol decode to a zero frequency, which
+    // RansDecoder::finish() reports as corrupt.
+    const uint32_t* slots() const { return slotTable.data(); }
+
+   private:
+    uint16_t freq[256] = {};
+    uint16_t cumulative[256] = {};
+    std::vector<uint32_t> slotTable;
+
+    void buildSlots();
+};
+
+// Tables picked per symbol by a context that both sides know before the
+// symbol is coded, such as what surrounds it. The decode entries of all
+// tables sit in one array, table after table, so a decoder looks up each
+// lane in the table of its own symbol's context with a single gather.
+class RansContextTables {
+   public:
+    RansContextTables() = default;
+    explicit RansContextTables(std::vector<RansTable> tables);
+
+    size_t size() const { return tables.size(); }
+    const RansTable& operator[](size_t context) const {
+        return tables[context];
+    }
+    // kRansScale decode entries per context (see RansTable::slots)
+    const uint32_t* slots() const { return slotTable.data(); }
+
+   private:
+    std::vector<RansTable> tables;
+    std::vector<uint32_t> slotTable;
+};
+
+// rANS is last in, first out: segments are encoded from the last to the
+// first and decoded from the first to the last. Each segment may use its
+// own table and any number of symbols: both sides start each segment
+// again at lane 0.
+class RansEncoder {
+   public:
+    RansEncoder();
+
+    void encodeSegment(const uint8_t* symbols, size_t count,
+                       const RansTable& table);
+    // Codes symbol i with the table of contexts[i], which must be below
+    // tables.size().
+    void encodeSegment(const uint8_t* symbols, const uint8_t* contexts,
+                       size_t count, const RansContextTables& tables);
+    // Appends the coded bytes to out.
+    void finish(std::vector<uint8_t>& out);
+    // Bytes the symbols coded so far take, the final states aside.
+    size_t size() const { return 2 * words.size(); }
+
+   private:
+    uint32_t state[kRansLanes];
+    std::vector<uint16_t> words;
+
+    template <typename TableAt>
+    void encodeSymbols(const uint8_t* symbols, size_t count,
+                       TableAt&& tableAt);
+};
+
+class RansDecoder {
+   public:
+    RansDecoder(const uint8_t* data, size_t size);
+
+    void decodeSegment(uint8_t* out, size_t count, const RansTable& table);
+    // Decodes symbol i with the table of contexts[i], which must be below
+    // tables.size().
+    void decodeSegment(uint8_t* out, const uint8_t* contexts, size_t count,
+                       const RansContextTables& tables);
+    // True when every byte was consumed and every lane returned to its
+    // initial state, which a corrupted or truncated stream fails.
+    bool finish() const;
+    // Bytes read so far, the initial states included. Once it has decoded
+    // the symbols an encoder coded after its size() was n, a decoder is n
+    // bytes short of the end.
+    size_t position() const { return 2 * next; }
+    // False once a read ran past the end or decoded an unused slot.
+    bool good() const { return !broken; }
+
+   private:
+    uint32_t state[kRansLanes];
+    const uint8_t* data;
+    size_t wordCount;
+    size_t next;
+    bool broken;
+
+    uint32_t readWord();
+    // Decodes with the decode entries at slots, offset by kRansScale per
+    // context when kContexts is set.
+    template <bool kContexts>
+    void decodeSymbols(uint8_t* out, const uint8_t* contexts, size_t count,
+                       const uint32_t* slots);
+    template <bool kContexts>
+    void decodeScalar(uint8_t* out, const uint8_t* contexts, size_t begin,
+                      size_t end, const uint32_t* slots);
+};
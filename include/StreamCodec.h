@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Entropy coders for the byte streams inside an encoded point cloud. Each
+// block records the coding it was written with, so an encoder can pick a
+// different one per stream.
+enum class StreamCoding : uint8_t {
+    // Stored as is
+    Raw = 0,
+    // rANS with one frequency table for the whole stream, stored up front
+    RansStatic = 1,
+    // rANS whose table is rebuilt from the symbols seen so far at growing
+    // intervals; no table is stored, and it follows drifting statistics
+    RansAdaptive = 2,
+};
+
+class StreamCodec {
+   public:
+    virtual ~StreamCodec() = default;
+
+    // Appends the coded form of data[0, size) to out.
+    virtual void encode(const uint8_t* data, size_t size,
+                        std::vector<uint8_t>& out) const = 0;
+    // Decodes a stream written by encode. Throws std::runtime_error on
+    // malformed input or when it would decode more than maxSize bytes.
+    virtual std::vector<uint8_t> decode(const uint8_t* data, size_t size,
+                                        size_t maxSize) const = 0;
+
+    // Throws std::runtime_error for an unknown coding.
+    static const StreamCodec& get(StreamCoding coding);
+};
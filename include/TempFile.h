@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Scratch file on local disk for data that does not fit in memory. The file
+// is unlinked as soon as it is created (on Windows, opened to be deleted on
+// close), so it goes away when closed, even if the process dies. Throws
+// std::runtime_error when it cannot be created, written or read.
+class TempFile {
+   public:
+    // Created in directory; when that is empty, in $TMPDIR (else /tmp), or
+    // in the temporary directory on Windows.
+    explicit TempFile(const std::string& directory = "");
+    ~TempFile();
+
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+
+    void write(const void* data, size_t size);
+    // Moves back to the start to read what was written.
+    void rewind();
+    // Reads up to size bytes and returns how many there were.
+    size_t read(void* data, size_t size);
+    // Reads exactly size bytes.
+    void readExact(void* data, size_t size);
+
+    uint64_t size() const { return written; }
+
+   private:
+    std::FILE* file;
+    uint64_t written;
+};
@@ -1,10 +1,26 @@
 #pragma once
 #include <glm/glm.hpp>
 
+#include "OctreeItemTraits.h"
+
 struct VertexData {
     glm::vec3 position;
     glm::vec3 color;
 
+    VertexData() = default;
     VertexData(const glm::vec3& pos, const glm::vec3& col)
         : position(pos), color(col) {}
 };
+
+// An octree stores only the color and hands vertices back with the position
+// they were inserted at.
+template <>
+struct OctreeItemTraits<VertexData> {
+    using Payload = glm::vec3;
+
+    static const Payload& pack(const VertexData& item) { return item.color; }
+    static VertexData unpack(const Payload& color,
+                             const glm::vec3& position) {
+        return VertexData(position, color);
+    }
+};
@@ -1,25 +1,71 @@
 #include "CompressedModel.h"
 
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "MappedFile.h"
 #include "Model.h"
+#include "OctreeFormat.h"
+#include "PointCloudCodec.h"
+
+namespace {
+
+CompressedModelFileHeader readFileHeader(const unsigned char* bytes,
+                                         size_t size,
+                                         const std::string& filename) {
+    CompressedModelFileHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error("Not a compressed model: " + filename);
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, kCompressedModelMagic,
+                    sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a compressed model: " + filename);
+    }
+    if (header.version != kCompressedModelVersion) {
+        throw std::runtime_error("Unsupported compressed model version in: " +
+                                 filename);
+    }
+    return header;
+}
+
+glm::vec3 toVec3(const float values[3]) {
+    return glm::vec3(values[0], values[1], values[2]);
+}
+
+}  // namespace
 
 CompressedModel::CompressedModel(std::unique_ptr<VertexOctree> octree,
                                  const glm::vec3& minBounds,
                                  const glm::vec3& maxBounds)
     : octree(std::move(octree)), minBounds(minBounds), maxBounds(maxBounds) {}
 
+CompressedModel::CompressedModel(std::unique_ptr<MappedFile> file,
+                                 const glm::vec3& minBounds,
+                                 const glm::vec3& maxBounds)
+    : mappedFile(std::move(file)), minBounds(minBounds), maxBounds(maxBounds) {
+    const size_t offset = sizeof(CompressedModelFileHeader);
+    mappedOctree = std::make_unique<MappedVertexOctree>(
+        mappedFile->data() + offset, mappedFile->size() - offset);
+}
+
+CompressedModel::~CompressedModel() = default;
+
 std::unique_ptr<Model> CompressedModel::decompress() const {
     auto model = std::make_unique<Model>();
 
-    // Query entire bounds to get all vertices
-    auto allVertices = octree->query(minBounds, maxBounds);
+    model->vertices.reserve(getVertexCount());
+    model->colors.reserve(getVertexCount());
 
-    model->vertices.reserve(allVertices.size());
-    model->colors.reserve(allVertices.size());
-
-    for (const auto& vertexData : allVertices) {
-        model->vertices.push_back(vertexData.position);
-        model->colors.push_back(vertexData.color);
-    }
+    // Stream every vertex in the bounds straight out of the octree
+    withTree([&](const auto& tree) {
+        tree.queryEach(minBounds, maxBounds,
+                       [&](const glm::vec3& color, const glm::vec3& position) {
+                           model->vertices.push_back(position);
+                           model->colors.push_back(color);
+                       });
+    });
 
     model->minBounds = minBounds;
     model->maxBounds = maxBounds;
@@ -27,13 +73,109 @@ std::unique_ptr<Model> CompressedModel::decompress() const {
     return model;
 }
 
+std::unique_ptr<Model> CompressedModel::decompressLevel(int level) const {
+    return PointCloudCodec::decodeLevel(getEncodedStream(), level);
+}
+
+std::unique_ptr<Model> CompressedModel::decompressRegion(
+    const glm::vec3& min, const glm::vec3& max) const {
+    return PointCloudCodec::decodeRegion(getEncodedStream(), min, max);
+}
+
+const std::vector<uint8_t>& CompressedModel::getEncodedStream() const {
+    std::lock_guard<std::mutex> lock(encodeMutex);
+    if (encodedStream.empty()) {
+        withTree([&](const auto& tree) {
+            encodedStream = PointCloudCodec::encode(tree, tree.getMaxDepth());
+        });
+    }
+    return encodedStream;
+}
+
 size_t CompressedModel::getCompressedSize() const {
-    // Estimate based on octree structure
-    // This is a simplified calculation
-    return sizeof(CompressedModel) + getVertexCount() * sizeof(VertexData);
+    return getEncodedStream().size();
+}
+
+std::vector<VertexData> CompressedModel::query(const glm::vec3& min,
+                                               const glm::vec3& max) const {
+    std::vector<VertexData> results;
+    withTree([&](const auto& tree) { results = tree.query(min, max); });
+    return results;
 }
 
 size_t CompressedModel::getVertexCount() const {
-    auto allVertices = octree->query(minBounds, maxBounds);
-    return allVertices.size();
+    size_t count = 0;
+    withTree([&](const auto& tree) { count = tree.size(); });
+    return count;
+}
+
+int CompressedModel::getActualMaxDepth() const {
+    int depth = 0;
+    withTree([&](const auto& tree) { depth = tree.getActualMaxDepth(); });
+    return depth;
+}
+
+void CompressedModel::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    if (mappedFile) {
+        // Already in the on-disk format
+        file.write(reinterpret_cast<const char*>(mappedFile->data()),
+                   static_cast<std::streamsize>(mappedFile->size()));
+        if (!file) {
+            throw std::runtime_error("Failed to write file: " + filename);
+        }
+        return;
+    }
+
+    CompressedModelFileHeader header{};
+    std::memcpy(header.magic, kCompressedModelMagic, sizeof(header.magic));
+    header.version = kCompressedModelVersion;
+    for (int i = 0; i < 3; ++i) {
+        header.minBounds[i] = minBounds[i];
+        header.maxBounds[i] = maxBounds[i];
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    octree->write(file);
+
+    if (!file) {
+        throw std::runtime_error("Failed to write file: " + filename);
+    }
+}
+
+std::unique_ptr<CompressedModel> CompressedModel::load(
+    const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    unsigned char headerBytes[sizeof(CompressedModelFileHeader)] = {};
+    file.read(reinterpret_cast<char*>(headerBytes), sizeof(headerBytes));
+    CompressedModelFileHeader header = readFileHeader(
+        headerBytes, static_cast<size_t>(file.gcount()), filename);
+
+    auto octree = VertexOctree::read(file);
+    return std::make_unique<CompressedModel>(
+        std::move(octree), toVec3(header.minBounds), toVec3(header.maxBounds));
+}
+
+std::unique_ptr<CompressedModel> CompressedModel::map(
+    const std::string& filename) {
+    auto file = std::make_unique<MappedFile>(filename);
+    CompressedModelFileHeader header =
+        readFileHeader(file->data(), file->size(), filename);
+    return std::unique_ptr<CompressedModel>(
+        new CompressedModel(std::move(file), toVec3(header.minBounds),
+                            toVec3(header.maxBounds)));
+}
+
+bool CompressedModel::isCompressedModelFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(kCompressedModelMagic)];
+    return file.read(magic, sizeof(magic)) &&
+           std::memcmp(magic, kCompressedModelMagic, sizeof(magic)) == 0;
 }
@@ -0,0 +1,182 @@
+#include "ExternalSort.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "Morton.h"
+
+namespace {
+
+// Peak bytes per buffered point: the buffer, plus its sorted keys and
+// then its sorted copy when it is sorted in memory
+constexpr size_t kBytesPerPoint = 2 * sizeof(MortonPoint) + sizeof(MortonEntry);
+// Smallest read buffer a run gets during a merge
+constexpr size_t kMinReadBuffer = size_t(1) << 20;
+
+void writePoints(TempFile& file, const std::vector<MortonPoint>& points) {
+    file.write(points.data(), points.size() * sizeof(MortonPoint));
+}
+
+}  // namespace
+
+// Stable k-way merge of sorted runs, each read through its own buffer.
+class ExternalMortonSort::Merge {
+   public:
+    Merge(const std::vector<TempFile*>& runs, size_t bufferBytes) {
+        size_t points = std::max<size_t>(bufferBytes / sizeof(MortonPoint), 1);
+        readers.resize(runs.size());
+        for (size_t i = 0; i < runs.size(); ++i) {
+            Reader& reader = readers[i];
+            reader.file = runs[i];
+            reader.file->rewind();
+            reader.points.resize(points);
+            if (reader.refill()) heap.emplace(reader.front().key, i);
+        }
+    }
+
+    bool next(MortonPoint& point) {
+        if (heap.empty()) return false;
+        size_t run = heap.top().second;
+        heap.pop();
+        Reader& reader = readers[run];
+        point = reader.front();
+        if (++reader.position < reader.count || reader.refill()) {
+            heap.emplace(reader.front().key, run);
+        }
+        return true;
+    }
+
+   private:
+    struct Reader {
+        TempFile* file;
+        std::vector<MortonPoint> points;
+        size_t count;
+        size_t position;
+
+        const MortonPoint& front() const { return points[position]; }
+
+        bool refill() {
+            count = file->read(points.data(),
+                               points.size() * sizeof(MortonPoint)) /
+                    sizeof(MortonPoint);
+            position = 0;
+            return count > 0;
+        }
+    };
+
+    std::vector<Reader> readers;
+    // Smallest key first, then the earliest run, which keeps equal keys in
+    // push order
+    std::priority_queue<std::pair<uint64_t, size_t>,
+                        std::vector<std::pair<uint64_t, size_t>>,
+                        std::greater<std::pair<uint64_t, size_t>>>
+        heap;
+};
+
+ExternalMortonSort::ExternalMortonSort(int keyBits, size_t memoryLimit,
+                                       const std::string& tempDirectory)
+    : keyBits(keyBits),
+      memoryLimit(memoryLimit),
+      tempDirectory(tempDirectory),
+      capacity(std::min<size_t>(
+          std::max<size_t>(memoryLimit / kBytesPerPoint, 1), UINT32_MAX)),
+      count(0),
+      spilled(0),
+      position(0) {}
+
+ExternalMortonSort::~ExternalMortonSort() = default;
+
+void ExternalMortonSort::push(const MortonPoint& point) {
+    if (buffer.size() == capacity) spill();
+    if (buffer.size() == buffer.capacity()) {
+        // Grow up to the capacity but never past it
+        buffer.reserve(std::min(capacity, std::max<size_t>(
+                                              2 * buffer.size(), 4096)));
+    }
+    buffer.push_back(point);
+    ++count;
+}
+
+void ExternalMortonSort::finish() {
+    if (runs.empty()) {
+        std::vector<MortonPoint> sorted;
+        sortBuffer(sorted);
+        buffer.swap(sorted);
+        position = 0;
+        return;
+    }
+    if (!buffer.empty()) spill();
+    std::vector<MortonPoint>().swap(buffer);
+
+    // Merge groups of runs until every remaining one gets a read buffer
+    const size_t fanIn = std::max<size_t>(memoryLimit / kMinReadBuffer, 2);
+    while (runs.size() > fanIn) {
+        std::vector<std::unique_ptr<TempFile>> merged;
+        for (size_t first = 0; first < runs.size(); first += fanIn) {
+            size_t last = std::min(first + fanIn, runs.size());
+            if (last - first == 1) {
+                merged.push_back(std::move(runs[first]));
+                continue;
+            }
+            std::vector<TempFile*> group;
+            for (size_t i = first; i < last; ++i) {
+                group.push_back(runs[i].get());
+            }
+            const size_t bufferBytes = memoryLimit / (group.size() + 1);
+            Merge groupMerge(group, bufferBytes);
+
+            auto run = std::make_unique<TempFile>(tempDirectory);
+            std::vector<MortonPoint> chunk;
+            chunk.reserve(
+                std::max<size_t>(bufferBytes / sizeof(MortonPoint), 1));
+            MortonPoint point;
+            while (groupMerge.next(point)) {
+                chunk.push_back(point);
+                if (chunk.size() == chunk.capacity()) {
+                    writePoints(*run, chunk);
+                    chunk.clear();
+                }
+            }
+            writePoints(*run, chunk);
+            merged.push_back(std::move(run));
+            ++spilled;
+        }
+        runs = std::move(merged);
+    }
+
+    std::vector<TempFile*> files;
+    for (const auto& run : runs) files.push_back(run.get());
+    merge = std::make_unique<Merge>(files, memoryLimit / runs.size());
+}
+
+bool ExternalMortonSort::next(MortonPoint& point) {
+    if (merge) return merge->next(point);
+    if (position == buffer.size()) return false;
+    point = buffer[position++];
+    return true;
+}
+
+void ExternalMortonSort::spill() {
+    std::vector<MortonPoint> sorted;
+    sortBuffer(sorted);
+    auto run = std::make_unique<TempFile>(tempDirectory);
+    writePoints(*run, sorted);
+    runs.push_back(std::move(run));
+    ++spilled;
+    buffer.clear();
+}
+
+void ExternalMortonSort::sortBuffer(std::vector<MortonPoint>& sorted) {
+    std::vector<MortonEntry> entries(buffer.size());
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        entries[i] = {buffer[i].key, i};
+    }
+    radixSortMorton(entries, keyBits);
+    sorted.reserve(buffer.size());
+    for (const MortonEntry& entry : entries) {
+        sorted.push_back(buffer[entry.index]);
+    }
+}
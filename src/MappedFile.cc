@@ -0,0 +1,94 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdexcept>
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename)
+    : bytes(nullptr), length(0) {
+    HANDLE file = ::CreateFileA(filename.c_str(), GENERIC_READ,
+                                FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size)) {
+        ::CloseHandle(file);
+        throw std::runtime_error("Failed to stat file: " + filename);
+    }
+    length = static_cast<size_t>(size.QuadPart);
+
+    // An empty file cannot be mapped
+    if (length > 0) {
+        HANDLE mapping =
+            ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)
+                             : nullptr;
+        if (mapping) ::CloseHandle(mapping);
+        if (!view) {
+            ::CloseHandle(file);
+            throw std::runtime_error("Failed to map file: " + filename);
+        }
+        bytes = static_cast<const unsigned char*>(view);
+    }
+
+    // The view keeps the mapping and the file referenced
+    ::CloseHandle(file);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes) {
+        ::UnmapViewOfFile(bytes);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename)
+    : bytes(nullptr), length(0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat file: " + filename);
+    }
+    length = static_cast<size_t>(info.st_size);
+
+    if (length > 0) {
+        void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Failed to map file: " + filename);
+        }
+        bytes = static_cast<const unsigned char*>(mapping);
+    }
+
+    // The mapping keeps the file referenced
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes) {
+        ::munmap(const_cast<unsigned char*>(bytes), length);
+    }
+}
+
+#endif
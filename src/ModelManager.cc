@@ -4,6 +4,7 @@
 #include "Model.h"
 #include "OBJLoader.h"
 #include "OctreeCompressor.h"
+#include "PointCloudCodec.h"
 
 ModelManager::ModelManager()
     : loader(std::make_unique<OBJLoader>()),
@@ -22,9 +23,32 @@ std::unique_ptr<CompressedModel> ModelManager::compressModel(
 
 std::unique_ptr<CompressedModel> ModelManager::loadCompressedModel(
     const std::string& filename) {
+    if (CompressedModel::isCompressedModelFile(filename)) {
+        return CompressedModel::load(filename);
+    }
+    if (PointCloudCodec::isEncodedFile(filename)) {
+        auto stream = PointCloudCodec::readFile(filename);
+        return compressModel(*PointCloudCodec::decode(stream));
+    }
+
     auto model = loadModel(filename);
     if (!model) {
         return nullptr;
     }
     return compressModel(*model);
 }
+
+void ModelManager::saveCompressedModel(const CompressedModel& model,
+                                       const std::string& filename) {
+    model.save(filename);
+}
+
+void ModelManager::saveEncodedModel(const CompressedModel& model,
+                                    const std::string& filename) {
+    PointCloudCodec::writeFile(model.getEncodedStream(), filename);
+}
+
+std::unique_ptr<CompressedModel> ModelManager::mapCompressedModel(
+    const std::string& filename) {
+    return CompressedModel::map(filename);
+}
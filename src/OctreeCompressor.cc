@@ -1,9 +1,13 @@
 #include "OctreeCompressor.h"
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 
 #include "CompressedModel.h"
 #include "Model.h"
+#include "PointCloudCodec.h"
 #include "VertexData.h"
 
 OctreeCompressor::OctreeCompressor(const Settings& settings)
@@ -17,22 +21,124 @@ std::unique_ptr<CompressedModel> OctreeCompressor::compress(
         return nullptr;
     }
 
-    // Calculate octree bounds
-    glm::vec3 center = (model.minBounds + model.maxBounds) * 0.5f;
-    glm::vec3 extent = model.maxBounds - model.minBounds;
-    float maxExtent = std::max({extent.x, extent.y, extent.z});
-    float halfSize = maxExtent * 0.5f * 1.1f;  // Add 10% padding
+    auto octree =
+        makeOctree(model.minBounds, model.maxBounds, settings.growRoot);
+    const auto root = octree->getRootCube();
+    glm::vec3 center = root.center;
+    float halfSize = root.halfSize;
+
+    // Bulk-build from all vertices in Morton order
+    octree->build(
+        model.vertices,
+        [&](size_t i) {
+            return VertexData(model.vertices[i], model.colors[i]);
+        },
+        settings.threadCount);
+
+    auto compressed = std::make_unique<CompressedModel>(
+        std::move(octree), model.minBounds, model.maxBounds);
+    if (settings.encodeStream) {
+        compressed->setEncodedStream(
+            PointCloudCodec::encode(model, center, halfSize, settings.maxDepth,
+                                    settings.streamOptions));
+    }
+    return compressed;
+}
+
+void OctreeCompressor::begin(const glm::vec3& minBounds,
+                             const glm::vec3& maxBounds) {
+    begin();
+    session = makeOctree(minBounds, maxBounds, settings.growRoot);
+}
+
+void OctreeCompressor::begin() {
+    sessionOpen = true;
+    session.reset();
+    sessionMin = glm::vec3(std::numeric_limits<float>::max());
+    sessionMax = glm::vec3(std::numeric_limits<float>::lowest());
+}
+
+void OctreeCompressor::push(const glm::vec3* positions,
+                            const glm::vec3* colors, size_t count) {
+    if (!sessionOpen) {
+        throw std::runtime_error("No compression session to push points to");
+    }
+
+    if (!session) {
+        // Root around the first chunk's finite points, grown for the rest
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        for (size_t i = 0; i < count; ++i) {
+            const glm::vec3& p = positions[i];
+            if (std::isfinite(p.x) && std::isfinite(p.y) &&
+                std::isfinite(p.z)) {
+                min = glm::min(min, p);
+                max = glm::max(max, p);
+            }
+        }
+        if (min.x > max.x) return;
+        session = makeOctree(min, max, true);
+    }
 
-    // Create octree
-    auto octree = std::make_unique<Octree<VertexData>>(center, halfSize,
-                                                       settings.maxDepth);
+    session->insertBatch(positions, count, [&](size_t i) {
+        return VertexData(positions[i], colors[i]);
+    });
+    // The root now holds every point the tree kept and none it dropped
+    for (size_t i = 0; i < count; ++i) {
+        if (!session->inRoot(positions[i])) continue;
+        sessionMin = glm::min(sessionMin, positions[i]);
+        sessionMax = glm::max(sessionMax, positions[i]);
+    }
+}
 
-    // Insert all vertices
-    for (size_t i = 0; i < model.vertices.size(); ++i) {
-        VertexData data(model.vertices[i], model.colors[i]);
-        octree->insert(data, model.vertices[i]);
+void OctreeCompressor::push(const std::vector<glm::vec3>& positions,
+                            const std::vector<glm::vec3>& colors) {
+    if (positions.size() != colors.size()) {
+        throw std::runtime_error("Pushed positions and colors differ in count");
     }
+    push(positions.data(), colors.data(), positions.size());
+}
+
+std::unique_ptr<CompressedModel> OctreeCompressor::finish() {
+    if (!sessionOpen) {
+        throw std::runtime_error("No compression session to finish");
+    }
+
+    sessionOpen = false;
+    std::unique_ptr<Octree<VertexData>> octree = std::move(session);
+    if (!octree || octree->size() == 0) {
+        return nullptr;
+    }
+
+    // A grown tree is deeper, keeping the cell size of the original root
+    std::vector<uint8_t> stream;
+    if (settings.encodeStream) {
+        stream = PointCloudCodec::encode(*octree, octree->getMaxDepth(),
+                                         settings.streamOptions);
+    }
+    auto compressed = std::make_unique<CompressedModel>(
+        std::move(octree), sessionMin, sessionMax);
+    compressed->setEncodedStream(std::move(stream));
+    return compressed;
+}
+
+std::unique_ptr<Octree<VertexData>> OctreeCompressor::makeOctree(
+    const glm::vec3& minBounds, const glm::vec3& maxBounds,
+    bool growRoot) const {
+    glm::vec3 center = (minBounds + maxBounds) * 0.5f;
+    glm::vec3 extent = maxBounds - minBounds;
+    float maxExtent = std::max({extent.x, extent.y, extent.z});
+    // Add 10% padding. Coincident points still get a root of some size,
+    // so that it can grow toward later points.
+    float minHalfSize = std::numeric_limits<float>::epsilon() *
+                        std::max({1.0f, std::abs(center.x), std::abs(center.y),
+                                  std::abs(center.z)});
+    float halfSize = std::max(
+        {maxExtent * 0.5f * 1.1f, settings.minNodeSize, minHalfSize});
 
-    return std::make_unique<CompressedModel>(std::move(octree), model.minBounds,
-                                             model.maxBounds);
+    return std::make_unique<Octree<VertexData>>(
+        center, halfSize, settings.maxDepth,
+        static_cast<size_t>(std::max(settings.leafCapacity, 0)),
+        settings.minNodeSize, growRoot,
+        static_cast<size_t>(std::max(settings.minPointsPerNode, 0)));
 }
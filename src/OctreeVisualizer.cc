@@ -8,26 +8,46 @@ OctreeVisualizer::extractBoundingBoxes(const Octree<VertexData>* octree,
     std::vector<BoundingBox> boxes;
     if (!octree || !octree->getRoot()) return boxes;
 
-    extractBoxesRecursive(octree->getRoot(), boxes, 0, maxLevel);
+    extractBoxesRecursive(*octree, octree->getRootIndex(),
+                          octree->getRootCube(), boxes, 0, maxLevel);
     return boxes;
 }
 
-void OctreeVisualizer::extractBoxesRecursive(
-    const typename Octree<VertexData>::Node* node,
-    std::vector<BoundingBox>& boxes, int currentLevel, int maxLevel) const {
-    if (!node) return;
+std::vector<OctreeVisualizer::BoundingBox>
+OctreeVisualizer::extractBoundingBoxes(const MappedOctree<VertexData>* octree,
+                                       int maxLevel) const {
+    std::vector<BoundingBox> boxes;
+    if (!octree) return boxes;
+
+    extractBoxesRecursive(*octree, octree->getRootIndex(),
+                          octree->getRootCube(), boxes, 0, maxLevel);
+    return boxes;
+}
+
+template <typename Tree>
+void OctreeVisualizer::extractBoxesRecursive(const Tree& octree,
+                                             typename Tree::NodeIndex index,
+                                             const typename Tree::Cube& cube,
+                                             std::vector<BoundingBox>& boxes,
+                                             int currentLevel,
+                                             int maxLevel) const {
+    if (index == Tree::kNullNode) return;
+    const auto& node = octree.getNode(index);
 
     // Stop if we've reached the max level (unless maxLevel is -1, which means
     // no limit)
     if (maxLevel >= 0 && currentLevel > maxLevel) return;
 
     // Only add boxes that contain data or have children with data
-    bool hasData = !node->data.empty();
+    bool hasData = octree.getItemCount(node) > 0;
     bool hasChildrenWithData = false;
 
-    if (!node->isLeaf()) {
-        for (const auto& child : node->children) {
-            if (child && (!child->data.empty() || !child->isLeaf())) {
+    if (!node.isLeaf()) {
+        for (int i = 0; i < 8; ++i) {
+            auto childIndex = octree.getChild(node, i);
+            if (childIndex == Tree::kNullNode) continue;
+            const auto& child = octree.getNode(childIndex);
+            if (octree.getItemCount(child) > 0 || !child.isLeaf()) {
                 hasChildrenWithData = true;
                 break;
             }
@@ -36,18 +56,19 @@ void OctreeVisualizer::extractBoxesRecursive(
 
     if (hasData || hasChildrenWithData) {
         BoundingBox box;
-        box.center = node->center;
-        box.halfSize = glm::vec3(node->halfSize);
+        box.center = cube.center;
+        box.halfSize = glm::vec3(cube.halfSize);
         box.hasData = hasData;
         box.level = currentLevel;
         boxes.push_back(box);
     }
 
     // Recursively process children
-    if (!node->isLeaf()) {
-        for (const auto& child : node->children) {
-            extractBoxesRecursive(child.get(), boxes, currentLevel + 1,
-                                  maxLevel);
+    if (!node.isLeaf()) {
+        for (int i = 0; i < 8; ++i) {
+            extractBoxesRecursive(octree, octree.getChild(node, i),
+                                  Tree::getChildCube(cube, i), boxes,
+                                  currentLevel + 1, maxLevel);
         }
     }
 }
@@ -0,0 +1,2034 @@
+#include "PointCloudCodec.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "ByteStream.h"
+#include "ExternalSort.h"
+#include "MappedOctree.h"
+#include "Model.h"
+#include "Morton.h"
+#include "Octree.h"
+#include "OctreeFormat.h"
+#include "Parallel.h"
+#include "Raht.h"
+#include "Rans.h"
+#include "TempFile.h"
+#include "VertexData.h"
+
+namespace {
+
+constexpr char kMagic[4] = {'O', 'C', 'T', 'G'};
+// Sanity bound that keeps size arithmetic on untrusted counts in range
+constexpr uint64_t kMaxPoints = uint64_t(1) << 40;
+
+// Grid over the root cube shared by encoder and decoder.
+struct Grid {
+    glm::vec3 origin;
+    float cellSize;
+    uint32_t cells;
+
+    Grid(const glm::vec3& center, float halfSize, int depth)
+        : origin(center - glm::vec3(halfSize)),
+          cellSize(2.0f * halfSize / static_cast<float>(1u << depth)),
+          cells(1u << depth) {}
+
+    uint32_t cell(float value, float low) const {
+        float scaled = (value - low) / cellSize;
+        if (!(scaled >= 0.0f)) return 0;
+        if (scaled >= static_cast<float>(cells)) return cells - 1;
+        return static_cast<uint32_t>(scaled);
+    }
+
+    uint64_t key(const glm::vec3& p) const {
+        return mortonEncode(cell(p.x, origin.x), cell(p.y, origin.y),
+                            cell(p.z, origin.z));
+    }
+
+    glm::vec3 cellCenter(uint64_t key) const {
+        uint32_t x, y, z;
+        mortonDecode(key, x, y, z);
+        return origin + glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f) * cellSize;
+    }
+
+};
+
+// Octants set in each occupancy code, lowest first, padded with zeros, so
+// that a node's children are written eight at a time without a branch on
+// its code.
+struct OctantTable {
+    uint8_t octants[256][8];
+
+    constexpr OctantTable() : octants() {
+        for (unsigned code = 0; code < 256; ++code) {
+            unsigned count = 0;
+            for (unsigned octant = 0; octant < 8; ++octant) {
+                if (code >> octant & 1) octants[code][count++] = octant;
+            }
+        }
+    }
+};
+
+constexpr OctantTable kOctants;
+
+// Occupancy codes are coded one byte per node with a static rANS table
+// picked by how many of the node's six face neighbours are occupied. The
+// neighbours of every node of a level are known once the level above is,
+// so a whole level is one segment whose lanes each look up the table of
+// their own node.
+constexpr int kNeighborContexts = 7;
+
+// Visits the nodes of the occupancy tree breadth first down to depth, one
+// level at a time. codeLevel(level, contexts, count) gets the number of
+// occupied face neighbours of each of the level's count nodes and returns
+// a pointer to their occupancy codes: the encoder returns the known ones,
+// the decoder what it decoded. Face neighbours are carried down from level
+// to level: a child's neighbour is either a sibling or a child of its
+// parent's neighbour, so finding it is a popcount instead of a search.
+// Returns the Morton keys of the occupied cells at depth.
+template <typename LevelFn>
+std::vector<uint64_t> walkOccupancy(int depth, uint64_t maxCells,
+                                    LevelFn&& codeLevel) {
+    // Code and children of a node, kept together so that a neighbour lookup
+    // touches one cache line.
+    struct Coded {
+        uint32_t firstChild;
+        uint32_t code;
+    };
+    // Neighbour order: -x, +x, -y, +y, -z, +z. A missing neighbour is the
+    // index one past the level's last node, where an empty node sits, so
+    // lookups need no branch on whether the neighbour is there.
+    using Neighbors = std::array<uint32_t, 6>;
+    std::vector<uint64_t> keys{0};
+    std::vector<Neighbors> neighbors(1);
+    neighbors[0].fill(1);
+    std::vector<uint8_t> contexts{0};
+    std::vector<Coded> coded;
+    std::vector<uint64_t> childKeys;
+    std::vector<Neighbors> childNeighbors;
+    std::vector<uint8_t> childContexts;
+
+    for (int level = 0; level < depth; ++level) {
+        const size_t count = keys.size();
+        const uint8_t* codes = codeLevel(level, contexts.data(), count);
+        coded.resize(count + 1);
+        coded[count] = {0, 0};
+        uint64_t children = 0;
+        for (size_t i = 0; i < count; ++i) {
+            coded[i] = {static_cast<uint32_t>(children), codes[i]};
+            children += popcount8(codes[i]);
+        }
+        if (children > maxCells) ByteReader::fail("more cells than points");
+
+        // Eight keys per node into room for eight more past the end; the
+        // next node's overwrite the ones past its own children
+        childKeys.resize(children + 8);
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t* child = &childKeys[coded[i].firstChild];
+            const uint8_t* octants = kOctants.octants[coded[i].code];
+            const uint64_t parent = keys[i] << 3;
+            for (int j = 0; j < 8; ++j) child[j] = parent | octants[j];
+        }
+        childKeys.resize(children);
+        if (level + 1 == depth) {
+            keys.swap(childKeys);
+            break;
+        }
+
+        // The children's neighbours only matter when their children have
+        // codes, which on the last coded level they do not; its contexts
+        // need the neighbours' presence alone
+        const bool childrenCoded = level + 2 < depth;
+        // Whether a neighbour is there is as good as random, so its index
+        // is selected arithmetically rather than branched on
+        const uint32_t missing = static_cast<uint32_t>(children);
+        if (childrenCoded) childNeighbors.resize(children);
+        childContexts.resize(children);
+        for (size_t i = 0; i < count; ++i) {
+            const Coded parent = coded[i];
+            const uint8_t* octants = kOctants.octants[parent.code];
+            const unsigned childCount = popcount8(parent.code);
+            // The parent's neighbours, looked up once for all its children
+            Coded outer[6];
+            for (int d = 0; d < 6; ++d) outer[d] = coded[neighbors[i][d]];
+            for (unsigned j = 0; j < childCount; ++j) {
+                const unsigned octant = octants[j];
+                const uint32_t child = parent.firstChild + j;
+                unsigned occupied = 0;
+                for (int axis = 0; axis < 3; ++axis) {
+                    const unsigned across = octant ^ (1u << axis);
+                    const int upper = (octant >> axis) & 1;
+                    // Sibling on the inner side, a child of the parent's
+                    // neighbour on the outer side
+                    const Coded sides[2] = {outer[2 * axis + upper], parent};
+                    for (int side = 0; side < 2; ++side) {
+                        const Coded& node = sides[side];
+                        uint32_t present = (node.code >> across) & 1u;
+                        occupied += present;
+                        if (!childrenCoded) continue;
+                        uint32_t index =
+                            node.firstChild + childRank(node.code, across);
+                        uint32_t select = 0u - present;
+                        childNeighbors[child][2 * axis + (upper ^ side)] =
+                            (index & select) | (missing & ~select);
+                    }
+                }
+                childContexts[child] = static_cast<uint8_t>(occupied);
+            }
+        }
+        keys.swap(childKeys);
+        neighbors.swap(childNeighbors);
+        contexts.swap(childContexts);
+    }
+    return keys;
+}
+
+// Tables the occupancy codes of a stream are coded with when they are not
+// stored: one per neighbour count, or one for all nodes.
+enum OccupancyMode : uint8_t {
+    kOccupancyByNeighbors = 0,
+    kOccupancyOneTable = 1,
+};
+
+void writeStream(ByteWriter& out, StreamCoding coding,
+                 const std::vector<uint8_t>& bytes) {
+    std::vector<uint8_t> coded;
+    StreamCodec::get(coding).encode(bytes.data(), bytes.size(), coded);
+    out.u8(static_cast<uint8_t>(coding));
+    out.block(coded);
+}
+
+// A stream located in the input but not decoded yet.
+struct CodedStream {
+    const StreamCodec* codec;
+    ByteReader block;
+
+    static CodedStream read(ByteReader& in) {
+        const StreamCodec* codec =
+            &StreamCodec::get(static_cast<StreamCoding>(in.u8()));
+        return {codec, in.block()};
+    }
+
+    std::vector<uint8_t> decode(uint64_t maxSize) const {
+        return codec->decode(block.current(), block.remaining(),
+                             static_cast<size_t>(maxSize));
+    }
+};
+
+uint8_t quantizeColor(float value) {
+    float clamped = std::min(std::max(value, 0.0f), 1.0f);
+    return static_cast<uint8_t>(std::lround(clamped * 255.0f));
+}
+
+enum ColorMode : uint8_t {
+    kColorRgb8 = 0,
+    kColorRaht = 1,
+};
+
+// Chroma is less visible than luma and takes a coarser step.
+constexpr double kChromaStepScale = 2.0;
+
+float rahtStep(int quality) {
+    quality = std::min(std::max(quality, 0), 99);
+    return std::exp2(static_cast<float>(100 - quality) / 16.0f);
+}
+
+// YCoCg on the 0-255 scale, from a color clamped to [0, 1].
+void toYCoCg(const glm::vec3& color, double* out) {
+    double r = 255.0 * std::min(std::max(color.x, 0.0f), 1.0f);
+    double g = 255.0 * std::min(std::max(color.y, 0.0f), 1.0f);
+    double b = 255.0 * std::min(std::max(color.z, 0.0f), 1.0f);
+    out[0] = 0.25 * r + 0.5 * g + 0.25 * b;
+    out[1] = 0.5 * r - 0.5 * b;
+    out[2] = -0.25 * r + 0.5 * g - 0.25 * b;
+}
+
+glm::vec3 fromYCoCg(const double* in) {
+    auto channel = [](double value) {
+        return static_cast<float>(std::min(std::max(value / 255.0, 0.0), 1.0));
+    };
+    double base = in[0] - in[2];
+    return glm::vec3(channel(base + in[1]), channel(in[0] + in[2]),
+                     channel(base - in[1]));
+}
+
+uint64_t zigzag(int64_t value) {
+    return static_cast<uint64_t>(value) << 1 ^
+           static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Transform weights total kRootWeight instead of the point count. Each cell
+// splits its weight evenly among its occupied children, the first ones
+// taking the remainder, so a cell's weight depends only on the levels above
+// it and a partial decode knows it. 2^63 keeps every weight at least one
+// down to kMaxMortonDepth.
+constexpr uint64_t kRootWeight = uint64_t(1) << 63;
+
+// Weights of the children of cells with the given codes and weights.
+std::vector<uint64_t> splitWeights(const std::vector<uint8_t>& codes,
+                                   const std::vector<uint64_t>& weights) {
+    std::vector<uint64_t> children;
+    for (size_t i = 0; i < codes.size(); ++i) {
+        unsigned count = popcount8(codes[i]);
+        uint64_t share = weights[i] / count;
+        uint64_t remainder = weights[i] % count;
+        for (unsigned child = 0; child < count; ++child) {
+            children.push_back(share + (child < remainder ? 1 : 0));
+        }
+    }
+    return children;
+}
+
+// Quantiser step per channel. Coefficients scale with the square root of
+// the weights, so the steps are scaled from the point count to kRootWeight
+// to keep the color quality per point.
+std::array<double, Raht::kChannels> coefficientSteps(float step,
+                                                     uint64_t pointCount) {
+    double scale = static_cast<double>(step) *
+                   std::sqrt(static_cast<double>(kRootWeight) /
+                             static_cast<double>(pointCount));
+    return {scale, scale * kChromaStepScale, scale * kChromaStepScale};
+}
+
+// Quantised coefficients, one channel after another.
+std::vector<uint8_t> encodeCoefficients(
+    const double* coefficients, size_t count,
+    const std::array<double, Raht::kChannels>& steps) {
+    std::vector<uint8_t> bytes;
+    ByteWriter out(bytes);
+    for (int c = 0; c < Raht::kChannels; ++c) {
+        for (size_t i = 0; i < count; ++i) {
+            double value = coefficients[Raht::kChannels * i + c] / steps[c];
+            out.varint(zigzag(std::llround(value)));
+        }
+    }
+    return bytes;
+}
+
+// Appends the coefficients of one block to coefficients.
+void decodeCoefficients(const std::vector<uint8_t>& bytes,
+                        const std::array<double, Raht::kChannels>& steps,
+                        std::vector<double>& coefficients) {
+    std::vector<int64_t> values;
+    ByteReader in(bytes.data(), bytes.size());
+    while (!in.atEnd()) values.push_back(unzigzag(in.varint()));
+    if (values.size() % Raht::kChannels != 0) {
+        ByteReader::fail("bad color coefficient count");
+    }
+    const size_t count = values.size() / Raht::kChannels;
+    const size_t begin = coefficients.size();
+    coefficients.resize(begin + values.size());
+    for (int c = 0; c < Raht::kChannels; ++c) {
+        for (size_t i = 0; i < count; ++i) {
+            coefficients[begin + Raht::kChannels * i + c] =
+                static_cast<double>(values[c * count + i]) * steps[c];
+        }
+    }
+}
+
+// Occupancy codes per level of the tree above sorted, unique keys, built
+// bottom-up. Children of a node are contiguous in Morton order, so each
+// level is one linear pass. Leaves keys holding the keys of the roots.
+std::vector<std::vector<uint8_t>> buildLevels(std::vector<uint64_t>& keys,
+                                              int levels) {
+    std::vector<std::vector<uint8_t>> codes(levels);
+    for (int level = levels - 1; level >= 0; --level) {
+        size_t parents = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            uint64_t child = keys[i];
+            if (i == 0 || child >> 3 != keys[parents - 1]) {
+                keys[parents++] = child >> 3;
+                codes[level].push_back(0);
+            }
+            codes[level].back() |= static_cast<uint8_t>(1u << (child & 7));
+        }
+        keys.resize(parents);
+    }
+    return codes;
+}
+
+// Context of every node of a tree with the given codes per level, laid out
+// the same way.
+std::vector<std::vector<uint8_t>> occupancyContexts(
+    const std::vector<std::vector<uint8_t>>& codes) {
+    std::vector<std::vector<uint8_t>> contexts(codes.size());
+    walkOccupancy(static_cast<int>(codes.size()), UINT64_MAX,
+                  [&](int level, const uint8_t* context, size_t count) {
+                      contexts[level].assign(context, context + count);
+                      return codes[level].data();
+                  });
+    return contexts;
+}
+
+// Decodes the occupancy codes of the top `levels` levels of a tree into
+// codes per level, read(level, codes, contexts, count) reading each
+// level's.
+// Returns the keys of the cells below the last level decoded.
+template <typename ReadFn>
+std::vector<uint64_t> decodeOccupancy(int levels, uint64_t maxCells,
+                                      std::vector<std::vector<uint8_t>>& codes,
+                                      ReadFn&& read) {
+    codes.assign(levels, {});
+    return walkOccupancy(
+        levels, maxCells,
+        [&](int level, const uint8_t* contexts, size_t count) {
+            std::vector<uint8_t>& levelCodes = codes[level];
+            levelCodes.resize(count);
+            read(level, levelCodes.data(), contexts, count);
+            if (std::find(levelCodes.begin(), levelCodes.end(), 0) !=
+                levelCodes.end()) {
+                ByteReader::fail("bad occupancy codes");
+            }
+            return levelCodes.data();
+        });
+}
+
+// Sections of a subtree. Occupancy codes and point counts are its
+// geometry, RAHT coefficients or RGB8 colors its attributes. Which ones a
+// stream has depends on its color mode.
+enum SubtreeSection {
+    kSectionOccupancy,
+    kSectionCounts,
+    kSectionCoefficients,
+    kSectionColors,
+    kSubtreeSections,
+};
+
+// A subtree's geometry and attributes are coded apart, so that positions
+// decode without the colors.
+enum SubtreePayload {
+    kPayloadGeometry,
+    kPayloadAttributes,
+    kSubtreePayloads,
+};
+
+int payloadOf(int section) {
+    return section == kSectionOccupancy || section == kSectionCounts
+               ? kPayloadGeometry
+               : kPayloadAttributes;
+}
+
+bool hasSection(int section, uint8_t colorMode) {
+    switch (section) {
+        case kSectionCoefficients:
+            return colorMode == kColorRaht;
+        case kSectionColors:
+            return colorMode == kColorRgb8;
+    }
+    return true;
+}
+
+// How one section is coded throughout a stream: stored as is, or rANS
+// coded with tables built from that section of the whole stream and stored
+// once, one per context. Only occupancy codes have more than one context.
+// Sections of a single subtree are too short to carry tables of their own
+// or to adapt to their statistics.
+struct SectionCoding {
+    bool rans = false;
+    RansContextTables tables;
+};
+
+using SectionCodings = std::array<SectionCoding, kSubtreeSections>;
+
+// Symbol counts of each section over the whole stream, per context
+using Histogram = std::array<uint64_t, 256>;
+using SectionHistograms =
+    std::array<std::vector<Histogram>, kSubtreeSections>;
+
+SectionHistograms makeHistograms(size_t occupancyContexts) {
+    SectionHistograms histograms;
+    for (int section = 0; section < kSubtreeSections; ++section) {
+        histograms[section].assign(
+            section == kSectionOccupancy ? occupancyContexts : 1,
+            Histogram{});
+    }
+    return histograms;
+}
+
+// Counts symbol i of bytes in the histogram of contexts[i], or of the only
+// context without contexts.
+void countSymbols(const std::vector<uint8_t>& bytes, const uint8_t* contexts,
+                  std::vector<Histogram>& histograms) {
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        ++histograms[contexts ? contexts[i] : 0][bytes[i]];
+    }
+}
+
+RansTable tableFromHistogram(const Histogram& histogram) {
+    uint64_t largest = 0;
+    for (uint64_t count : histogram) largest = std::max(largest, count);
+    // Sections past 4 GiB are scaled to 32-bit counts, keeping every symbol
+    // that occurs
+    int shift = 0;
+    while ((largest >> shift) > UINT32_MAX) ++shift;
+    uint32_t counts[256];
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        uint64_t count = histogram[symbol];
+        counts[symbol] = static_cast<uint32_t>(
+            count == 0 ? 0 : std::max<uint64_t>(count >> shift, 1));
+    }
+    return RansTable::fromCounts(counts);
+}
+
+SectionCodings chooseCodings(const SectionHistograms& histograms,
+                             const std::array<StreamCoding,
+                                              kSubtreeSections>& requested) {
+    SectionCodings codings;
+    for (int section = 0; section < kSubtreeSections; ++section) {
+        uint64_t total = 0;
+        for (const Histogram& histogram : histograms[section]) {
+            for (uint64_t count : histogram) total += count;
+        }
+        codings[section].rans =
+            requested[section] != StreamCoding::Raw && total > 0;
+        if (codings[section].rans) {
+            std::vector<RansTable> tables;
+            for (const Histogram& histogram : histograms[section]) {
+                tables.push_back(tableFromHistogram(histogram));
+            }
+            codings[section].tables = RansContextTables(std::move(tables));
+        }
+    }
+    return codings;
+}
+
+void writeCoding(ByteWriter& out, const SectionCoding& coding) {
+    out.u8(coding.rans ? 1 : 0);
+    if (!coding.rans) return;
+    for (size_t context = 0; context < coding.tables.size(); ++context) {
+        coding.tables[context].write(out);
+    }
+}
+
+SectionCoding readCoding(ByteReader& in, size_t contexts) {
+    SectionCoding coding;
+    uint8_t rans = in.u8();
+    if (rans > 1) ByteReader::fail("bad section coding");
+    coding.rans = rans == 1;
+    if (coding.rans) {
+        std::vector<RansTable> tables;
+        for (size_t context = 0; context < contexts; ++context) {
+            tables.push_back(RansTable::read(in));
+        }
+        coding.tables = RansContextTables(std::move(tables));
+    }
+    return coding;
+}
+
+// Occupancy codes of one level, coded with the table of each node's context
+// when there is a table per context.
+void encodeLevelCodes(RansEncoder& encoder, const uint8_t* codes,
+                      const uint8_t* contexts, size_t count,
+                      const RansContextTables& tables) {
+    if (tables.size() > 1) {
+        encoder.encodeSegment(codes, contexts, count, tables);
+    } else {
+        encoder.encodeSegment(codes, count, tables[0]);
+    }
+}
+
+void decodeLevelCodes(RansDecoder& decoder, uint8_t* codes,
+                      const uint8_t* contexts, size_t count,
+                      const RansContextTables& tables) {
+    if (tables.size() > 1) {
+        decoder.decodeSegment(codes, contexts, count, tables);
+    } else {
+        decoder.decodeSegment(codes, count, tables[0]);
+    }
+}
+
+// Ends of the batches a section of varints is rANS coded in. Each batch
+// is as many bytes as varints are unfinished before it, which a decoder
+// knows without the section's size and which never reaches past its end.
+std::vector<size_t> varintBatches(const std::vector<uint8_t>& bytes) {
+    size_t unfinished = 0;
+    for (uint8_t byte : bytes) unfinished += byte < 0x80;
+    std::vector<size_t> ends;
+    size_t end = 0;
+    while (unfinished > 0) {
+        const size_t begin = end;
+        end += unfinished;
+        for (size_t i = begin; i < end; ++i) unfinished -= bytes[i] < 0x80;
+        ends.push_back(end);
+    }
+    return ends;
+}
+
+// Whether a section of payload that a stream has is stored, in which case
+// each piece of the payload starts with the size of its rANS coded part.
+bool hasStored(int payload, const SectionCodings& codings,
+               uint8_t colorMode) {
+    for (int section = 0; section < kSubtreeSections; ++section) {
+        if (payloadOf(section) == payload && hasSection(section, colorMode) &&
+            !codings[section].rans) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The symbols of one section in a piece, and for occupancy codes their
+// contexts.
+struct PieceSection {
+    int section;
+    const std::vector<uint8_t>* symbols;
+    const uint8_t* contexts;
+};
+
+// Codes one payload of a subtree as pieces, pieces[j] listing the sections
+// of piece j in the order they are decoded. The rANS coded sections of all
+// the pieces share one payload, cut after the words each piece decodes;
+// the first piece also holds the lanes' states. Stored sections follow the
+// coded part of their piece.
+std::vector<std::vector<uint8_t>> writePieces(
+    const std::vector<std::vector<PieceSection>>& pieces,
+    const SectionCodings& codings, bool stored) {
+    // Coded from the last piece to the first, the pieces are decoded from
+    // the first to the last. after[j] is what pieces j and later take.
+    RansEncoder encoder;
+    std::vector<size_t> after(pieces.size() + 1, 0);
+    bool coded = false;
+    for (size_t piece = pieces.size(); piece-- > 0;) {
+        for (size_t k = pieces[piece].size(); k-- > 0;) {
+            const PieceSection& part = pieces[piece][k];
+            const std::vector<uint8_t>& symbols = *part.symbols;
+            const RansContextTables& tables = codings[part.section].tables;
+            if (!codings[part.section].rans || symbols.empty()) continue;
+            coded = true;
+            if (part.section == kSectionOccupancy) {
+                encodeLevelCodes(encoder, symbols.data(), part.contexts,
+                                 symbols.size(), tables);
+            } else if (part.section == kSectionColors) {
+                encoder.encodeSegment(symbols.data(), symbols.size(),
+                                      tables[0]);
+            } else {
+                const std::vector<size_t> ends = varintBatches(symbols);
+                for (size_t batch = ends.size(); batch-- > 0;) {
+                    const size_t begin = batch == 0 ? 0 : ends[batch - 1];
+                    encoder.encodeSegment(&symbols[begin],
+                                          ends[batch] - begin, tables[0]);
+                }
+            }
+        }
+        after[piece] = encoder.size();
+    }
+    std::vector<uint8_t> payload;
+    if (coded) encoder.finish(payload);
+
+    std::vector<std::vector<uint8_t>> out(pieces.size());
+    size_t begin = 0;
+    for (size_t piece = 0; piece < pieces.size(); ++piece) {
+        const size_t end = coded ? payload.size() - after[piece + 1] : 0;
+        ByteWriter writer(out[piece]);
+        if (stored) writer.varint(end - begin);
+        writer.bytes(payload.data() + begin, end - begin);
+        for (const PieceSection& part : pieces[piece]) {
+            if (!codings[part.section].rans) writer.bytes(*part.symbols);
+        }
+        begin = end;
+    }
+    return out;
+}
+
+// Reads one payload of a subtree from its first pieces. Their rANS coded
+// parts are joined for one decoder and their stored parts for one reader,
+// and at the end of each piece both must have read up to where it ends.
+class PayloadReader {
+   public:
+    PayloadReader(const std::vector<ByteReader>& pieces,
+                  const SectionCodings& codings, bool stored)
+        : codings(codings), decoder(nullptr, 0), storedIn(nullptr, 0),
+          piece(0) {
+        for (ByteReader in : pieces) {
+            size_t size = in.remaining();
+            if (stored) {
+                uint64_t coded = in.varint();
+                if (coded > in.remaining()) ByteReader::fail("bad subtree");
+                size = static_cast<size_t>(coded);
+            }
+            const uint8_t* bytes = in.bytes(size);
+            codedBytes.insert(codedBytes.end(), bytes, bytes + size);
+            size = in.remaining();
+            bytes = in.bytes(size);
+            storedBytes.insert(storedBytes.end(), bytes, bytes + size);
+            codedEnds.push_back(codedBytes.size());
+            storedEnds.push_back(storedBytes.size());
+        }
+        if (!codedBytes.empty()) {
+            decoder = RansDecoder(codedBytes.data(), codedBytes.size());
+        }
+        storedIn = ByteReader(storedBytes.data(), storedBytes.size());
+    }
+
+    PayloadReader(const PayloadReader&) = delete;
+    PayloadReader& operator=(const PayloadReader&) = delete;
+
+    // Reads count symbols of section, for occupancy codes with their
+    // contexts.
+    void read(int section, uint8_t* out, size_t count,
+              const uint8_t* contexts = nullptr) {
+        const SectionCoding& coding = codings[section];
+        if (count == 0) return;
+        if (!coding.rans) {
+            std::memcpy(out, storedIn.bytes(count), count);
+        } else if (codedBytes.empty()) {
+            ByteReader::fail("corrupt subtree");
+        } else if (section == kSectionOccupancy) {
+            decodeLevelCodes(decoder, out, contexts, count, coding.tables);
+        } else {
+            decoder.decodeSegment(out, count, coding.tables[0]);
+        }
+    }
+
+    // The bytes of count varints of section, read in the batches
+    // writePieces codes them in.
+    std::vector<uint8_t> varints(int section, uint64_t count) {
+        std::vector<uint8_t> bytes;
+        uint64_t unfinished = count;
+        while (unfinished > 0) {
+            if (bytes.size() + unfinished > 10 * count) {
+                ByteReader::fail("bad subtree");
+            }
+            const size_t begin = bytes.size();
+            bytes.resize(begin + static_cast<size_t>(unfinished));
+            read(section, &bytes[begin], bytes.size() - begin);
+            for (size_t i = begin; i < bytes.size(); ++i) {
+                unfinished -= bytes[i] < 0x80;
+            }
+        }
+        return bytes;
+    }
+
+    // Fails unless the current piece was read to its end.
+    void endPiece() {
+        if (piece >= codedEnds.size() ||
+            (!codedBytes.empty() && (!decoder.good() ||
+                                     decoder.position() != codedEnds[piece])) ||
+            storedIn.position() != storedEnds[piece]) {
+            ByteReader::fail("corrupt subtree");
+        }
+        ++piece;
+    }
+
+    // Fails unless every piece was read and the decoder is back at its
+    // initial states.
+    void finish() const {
+        if (piece != codedEnds.size() ||
+            (!codedBytes.empty() && !decoder.finish())) {
+            ByteReader::fail("corrupt subtree");
+        }
+    }
+
+   private:
+    const SectionCodings& codings;
+    std::vector<uint8_t> codedBytes;
+    std::vector<uint8_t> storedBytes;
+    std::vector<size_t> codedEnds;
+    std::vector<size_t> storedEnds;
+    RansDecoder decoder;
+    ByteReader storedIn;
+    size_t piece;
+};
+
+// Header fields and where each section lies, found without decoding any.
+// Only the sections needed down to `levels` are read, so the rest of the
+// stream may be missing.
+struct Sections {
+    // Where the pieces of one subtree level, or of the leaves, lie: those
+    // of every subtree in Morton order of their roots, each subtree's
+    // geometry piece before its attribute piece. Piece k of the level is
+    // [ends[k - 1], ends[k]) of the bytes at data.
+    struct LevelPieces {
+        const uint8_t* data;
+        std::vector<uint64_t> ends;
+    };
+
+    int depth;
+    glm::vec3 center;
+    float halfSize;
+    uint64_t pointCount;
+    uint8_t colorMode;
+    float step;
+    int subtreeLevel;
+    // How occupancy codes and, with subtrees, each of their other sections
+    // are coded
+    SectionCodings codings;
+    // Per level above the subtrees: occupancy codes of its nodes and, with
+    // RAHT colors, the coefficients that split its cells
+    std::vector<ByteReader> occupancy;
+    std::vector<CodedStream> colors;
+    // Without subtrees (subtreeLevel == depth), the leaf point counts and
+    // RGB8 colors, located only for a full decode
+    CodedStream counts{nullptr, {nullptr, 0}};
+    CodedStream rgb{nullptr, {nullptr, 0}};
+    // Per subtree level down to the one decoded, then for a full decode the
+    // leaves
+    std::vector<LevelPieces> pieces;
+    // Bytes of the stream read
+    size_t size;
+
+    size_t subtreeCount() const {
+        return pieces.empty() ? 0 : pieces[0].ends.size() / kSubtreePayloads;
+    }
+
+    // One payload of subtree `index` from its first `count` pieces
+    PayloadReader payload(size_t index, int payload, size_t count) const {
+        std::vector<ByteReader> parts;
+        const size_t k = kSubtreePayloads * index + payload;
+        for (size_t j = 0; j < count; ++j) {
+            const LevelPieces& level = pieces[j];
+            const uint64_t begin = k == 0 ? 0 : level.ends[k - 1];
+            parts.emplace_back(level.data + begin,
+                               static_cast<size_t>(level.ends[k] - begin));
+        }
+        return PayloadReader(parts, codings,
+                             hasStored(payload, codings, colorMode));
+    }
+};
+
+Sections readSections(const uint8_t* data, size_t size, int levels) {
+    ByteReader in(data, size);
+    if (std::memcmp(in.bytes(sizeof(kMagic)), kMagic, sizeof(kMagic)) != 0) {
+        ByteReader::fail("bad magic");
+    }
+    if (in.u32() != PointCloudCodec::kVersion) {
+        throw std::runtime_error("Unsupported point cloud stream version");
+    }
+    Sections sections;
+    sections.depth = in.u8();
+    sections.center.x = in.f32();
+    sections.center.y = in.f32();
+    sections.center.z = in.f32();
+    sections.halfSize = in.f32();
+    sections.pointCount = in.u64();
+    if (sections.depth < 1 || sections.depth > kMaxMortonDepth ||
+        !(sections.halfSize > 0.0f) || !std::isfinite(sections.halfSize) ||
+        sections.pointCount > kMaxPoints) {
+        ByteReader::fail("bad header");
+    }
+    uint8_t occupancyMode = in.u8();
+    if (occupancyMode != kOccupancyByNeighbors &&
+        occupancyMode != kOccupancyOneTable) {
+        ByteReader::fail("bad occupancy mode");
+    }
+    sections.colorMode = in.u8();
+    sections.step = 0.0f;
+    if (sections.colorMode == kColorRaht) {
+        sections.step = in.f32();
+        if (!(sections.step > 0.0f) || !std::isfinite(sections.step)) {
+            ByteReader::fail("bad color step");
+        }
+    } else if (sections.colorMode != kColorRgb8) {
+        ByteReader::fail("bad color mode");
+    }
+    sections.subtreeLevel = in.u8();
+    if (sections.subtreeLevel < 1 || sections.subtreeLevel > sections.depth) {
+        ByteReader::fail("bad subtree level");
+    }
+    sections.codings[kSectionOccupancy] = readCoding(
+        in, occupancyMode == kOccupancyByNeighbors ? kNeighborContexts : 1);
+
+    // Level 0 also holds the DC term, needed even for the root alone
+    const int split = sections.subtreeLevel;
+    const int topLevels = std::min(std::max(levels, 1), split);
+    for (int level = 0; level < topLevels; ++level) {
+        sections.occupancy.push_back(in.block());
+        if (sections.colorMode == kColorRaht) {
+            sections.colors.push_back(CodedStream::read(in));
+        }
+    }
+    if (split == sections.depth) {
+        if (levels >= sections.depth) {
+            sections.counts = CodedStream::read(in);
+            if (sections.colorMode == kColorRgb8) {
+                sections.rgb = CodedStream::read(in);
+            }
+        }
+    } else if (levels > split) {
+        for (int section = kSectionOccupancy + 1; section < kSubtreeSections;
+             ++section) {
+            if (hasSection(section, sections.colorMode)) {
+                sections.codings[section] = readCoding(in, 1);
+            }
+        }
+        // Each subtree level and the leaves start with the size of every
+        // piece in them
+        const int blocks = levels >= sections.depth
+                               ? sections.depth - split + 1
+                               : levels - split;
+        for (int block = 0; block < blocks; ++block) {
+            ByteReader table = in.block();
+            Sections::LevelPieces level{nullptr, {}};
+            uint64_t end = 0;
+            while (!table.atEnd()) {
+                uint64_t piece = table.varint();
+                if (piece > in.remaining() - end) {
+                    ByteReader::fail("bad subtree table");
+                }
+                end += piece;
+                level.ends.push_back(end);
+            }
+            if (level.ends.size() % kSubtreePayloads != 0 ||
+                (block > 0 &&
+                 level.ends.size() != sections.pieces[0].ends.size())) {
+                ByteReader::fail("bad subtree table");
+            }
+            level.data = in.bytes(static_cast<size_t>(end));
+            sections.pieces.push_back(std::move(level));
+        }
+    }
+    sections.size = in.position();
+    return sections;
+}
+
+// Cells at or above the subtree level, decoded from the top sections
+struct TopTree {
+    std::vector<uint64_t> keys;
+    // Transform weights and RAHT mean colors of the cells
+    std::vector<uint64_t> weights;
+    std::vector<double> means;
+};
+
+TopTree decodeTop(const Sections& sections, int levels, uint64_t maxCells,
+                  bool colors = true) {
+    TopTree top;
+    if (sections.pointCount == 0) return top;
+    const SectionCoding& coding = sections.codings[kSectionOccupancy];
+    std::vector<std::vector<uint8_t>> codes;
+    top.keys = decodeOccupancy(
+        levels, maxCells, codes,
+        [&](int level, uint8_t* out, const uint8_t* contexts, size_t count) {
+            ByteReader block = sections.occupancy[level];
+            if (!coding.rans) {
+                if (block.remaining() != count) {
+                    ByteReader::fail("bad occupancy codes");
+                }
+                std::memcpy(out, block.bytes(count), count);
+                return;
+            }
+            RansDecoder decoder(block.current(), block.remaining());
+            decodeLevelCodes(decoder, out, contexts, count, coding.tables);
+            if (!decoder.finish()) ByteReader::fail("corrupt occupancy codes");
+        });
+    top.weights = {kRootWeight};
+    for (const auto& level : codes) {
+        top.weights = splitWeights(level, top.weights);
+    }
+
+    if (colors && sections.colorMode == kColorRaht) {
+        const auto steps =
+            coefficientSteps(sections.step, sections.pointCount);
+        std::vector<double> coefficients;
+        for (const CodedStream& block : sections.colors) {
+            decodeCoefficients(block.decode(Raht::kChannels * 10 *
+                                            sections.pointCount),
+                               steps, coefficients);
+        }
+        // The root alone needs only the DC term of the first block
+        if (coefficients.size() != Raht::kChannels * top.keys.size() &&
+            !(levels == 0 && !coefficients.empty())) {
+            ByteReader::fail("color coefficients do not match cells");
+        }
+        top.means = Raht::inverse(top.keys, top.weights, levels, coefficients);
+    }
+    return top;
+}
+
+// Appends count copies of value. Most cells hold one point, so this stays
+// a plain loop into reserved space rather than a fill insert per cell.
+void appendRepeated(std::vector<glm::vec3>& out, const glm::vec3& value,
+                    uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) out.push_back(value);
+}
+
+// Point count of each of `cells` leaf cells, which must not total more than
+// pointCount.
+std::vector<uint64_t> readCounts(const std::vector<uint8_t>& bytes,
+                                 size_t cells, uint64_t pointCount,
+                                 uint64_t& total) {
+    ByteReader counts(bytes.data(), bytes.size());
+    std::vector<uint64_t> repeats(cells);
+    total = 0;
+    for (uint64_t& repeat : repeats) {
+        repeat = counts.varint() + 1;
+        if (repeat > pointCount - total) {
+            ByteReader::fail("point counts exceed point total");
+        }
+        total += repeat;
+    }
+    if (!counts.atEnd()) ByteReader::fail("trailing point counts");
+    return repeats;
+}
+
+// Cells of a subtree decoded down to some level, before they are placed in
+// a model: their keys below the subtree root, the points in each, and their
+// colors, one per cell with RAHT colors or one per point with RGB8.
+struct SubtreeCells {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> repeats;
+    std::vector<glm::vec3> colors;
+    uint64_t points;
+};
+
+// Decodes subtree `index` down to `levels` levels below its root, into one
+// point per cell, or per point once levels reaches the leaves. Only the
+// pieces of those levels are read. Without colors, the cells' colors are
+// not reconstructed.
+SubtreeCells decodeSubtree(const Sections& sections, const TopTree& top,
+                           size_t index, int levels, bool colors = true) {
+    const bool full = levels == sections.depth - sections.subtreeLevel;
+    const uint64_t pointCount = sections.pointCount;
+    // A full decode also reads the leaves' pieces
+    const size_t pieces = static_cast<size_t>(levels) + (full ? 1 : 0);
+
+    PayloadReader geometry =
+        sections.payload(index, kPayloadGeometry, pieces);
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<uint64_t> keys = decodeOccupancy(
+        levels, pointCount, codes,
+        [&](int, uint8_t* out, const uint8_t* contexts, size_t count) {
+            geometry.read(kSectionOccupancy, out, count, contexts);
+            geometry.endPiece();
+        });
+    SubtreeCells cells;
+    cells.repeats.assign(keys.size(), 1);
+    cells.points = keys.size();
+    if (full) {
+        cells.repeats =
+            readCounts(geometry.varints(kSectionCounts, keys.size()),
+                       keys.size(), pointCount, cells.points);
+        geometry.endPiece();
+        geometry.finish();
+    }
+
+    if (colors && sections.colorMode == kColorRaht) {
+        PayloadReader attributes =
+            sections.payload(index, kPayloadAttributes, pieces);
+        // The subtree's own transform, with its root's low-pass value
+        // from the top
+        std::vector<uint64_t> weights{top.weights[index]};
+        double scale = std::sqrt(static_cast<double>(top.weights[index]));
+        std::vector<double> coefficients(
+            top.means.begin() + Raht::kChannels * index,
+            top.means.begin() + Raht::kChannels * (index + 1));
+        for (double& value : coefficients) value *= scale;
+        const auto steps = coefficientSteps(sections.step, pointCount);
+        // Level l holds the coefficients that split its cells into those
+        // of level l + 1
+        for (int level = 0; level < levels; ++level) {
+            const size_t next = level + 1 < levels
+                                    ? codes[level + 1].size()
+                                    : keys.size();
+            decodeCoefficients(
+                attributes.varints(kSectionCoefficients,
+                                   Raht::kChannels *
+                                       (next - codes[level].size())),
+                steps, coefficients);
+            attributes.endPiece();
+            weights = splitWeights(codes[level], weights);
+        }
+        if (full) {
+            attributes.endPiece();
+            attributes.finish();
+        }
+        std::vector<double> means =
+            Raht::inverse(keys, weights, levels, coefficients);
+        cells.colors.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            cells.colors.push_back(fromYCoCg(&means[Raht::kChannels * i]));
+        }
+    } else if (colors) {
+        // RGB8 colors are all in the leaves' piece
+        PayloadReader attributes =
+            sections.payload(index, kPayloadAttributes, pieces);
+        for (int level = 0; level < levels; ++level) attributes.endPiece();
+        std::vector<uint8_t> rgb(3 * static_cast<size_t>(cells.points));
+        attributes.read(kSectionColors, rgb.data(), rgb.size());
+        attributes.endPiece();
+        attributes.finish();
+        cells.colors.reserve(rgb.size() / 3);
+        for (size_t i = 0; i < rgb.size(); i += 3) {
+            cells.colors.emplace_back(rgb[i] / 255.0f, rgb[i + 1] / 255.0f,
+                                      rgb[i + 2] / 255.0f);
+        }
+    }
+    cells.keys = std::move(keys);
+    return cells;
+}
+
+// Writes the points of subtree `index`, decoded down to `levels` levels
+// below its root, to vertices and, unless null, their colors to colors.
+void placeCells(const Sections& sections, const TopTree& top, size_t index,
+                int levels, const SubtreeCells& cells, glm::vec3* vertices,
+                glm::vec3* colors) {
+    const Grid grid(sections.center, sections.halfSize,
+                    sections.subtreeLevel + levels);
+    const uint64_t root = top.keys[index] << (3 * levels);
+    const bool perCell = sections.colorMode == kColorRaht;
+    glm::vec3* const end = vertices + cells.points;
+    for (size_t i = 0; i < cells.keys.size(); ++i) {
+        const glm::vec3 center = grid.cellCenter(root | cells.keys[i]);
+        const uint64_t repeat = cells.repeats[i];
+        // Most cells hold a point or a few. Four copies are written
+        // whatever their count, the next cell's overwriting the extra ones,
+        // so that the count is not branched on
+        if (repeat <= 4 && end - vertices >= 4) {
+            for (int k = 0; k < 4; ++k) vertices[k] = center;
+            if (colors && perCell) {
+                for (int k = 0; k < 4; ++k) colors[k] = cells.colors[i];
+            }
+        } else {
+            std::fill(vertices, vertices + repeat, center);
+            if (colors && perCell) {
+                std::fill(colors, colors + repeat, cells.colors[i]);
+            }
+        }
+        vertices += repeat;
+        if (colors && perCell) colors += repeat;
+    }
+    if (colors && !perCell) {
+        std::copy(cells.colors.begin(), cells.colors.end(), colors);
+    }
+}
+
+// Decodes a stream without subtrees in full, with or without colors.
+std::unique_ptr<Model> decodeLeaves(const Sections& sections,
+                                    bool colors = true) {
+    const uint64_t pointCount = sections.pointCount;
+    // Counts and per-point colors bound the cells before the walk
+    std::vector<uint8_t> countBytes = sections.counts.decode(10 * pointCount);
+    uint64_t maxCells = std::min<uint64_t>(pointCount, countBytes.size());
+    std::vector<uint8_t> rgb;
+    if (colors && sections.colorMode == kColorRgb8) {
+        rgb = sections.rgb.decode(3 * pointCount);
+        if (rgb.size() % 3 != 0) ByteReader::fail("bad color stream");
+        maxCells = std::min<uint64_t>(maxCells, rgb.size() / 3);
+    }
+    const TopTree top =
+        decodeTop(sections, sections.depth, maxCells, colors);
+    uint64_t total;
+    std::vector<uint64_t> repeats =
+        readCounts(countBytes, top.keys.size(), pointCount, total);
+    if (total != pointCount ||
+        (colors && sections.colorMode == kColorRgb8 &&
+         total != rgb.size() / 3)) {
+        ByteReader::fail("point counts do not match point total");
+    }
+
+    auto model = std::make_unique<Model>();
+    model->vertices.reserve(total);
+    if (colors) model->colors.reserve(total);
+    const Grid grid(sections.center, sections.halfSize, sections.depth);
+    for (size_t i = 0; i < top.keys.size(); ++i) {
+        appendRepeated(model->vertices, grid.cellCenter(top.keys[i]),
+                       repeats[i]);
+        if (colors && sections.colorMode == kColorRaht) {
+            appendRepeated(model->colors,
+                           fromYCoCg(&top.means[Raht::kChannels * i]),
+                           repeats[i]);
+        }
+    }
+    for (size_t i = 0; i < rgb.size(); i += 3) {
+        model->colors.emplace_back(rgb[i] / 255.0f, rgb[i + 1] / 255.0f,
+                                   rgb[i + 2] / 255.0f);
+    }
+    model->calculateBounds();
+    return model;
+}
+
+// Appends the points of part inside the box [min, max].
+void appendInBox(Model& model, const Model& part, const glm::vec3& min,
+                 const glm::vec3& max) {
+    for (size_t i = 0; i < part.vertices.size(); ++i) {
+        const glm::vec3& p = part.vertices[i];
+        if (p.x >= min.x && p.y >= min.y && p.z >= min.z && p.x <= max.x &&
+            p.y <= max.y && p.z <= max.z) {
+            model.vertices.push_back(p);
+            model.colors.push_back(part.colors[i]);
+        }
+    }
+}
+
+// Appends every subtree decoded down to `levels` levels below its root,
+// checking the point total once they reach the leaves.
+void decodeSubtrees(Model& model, const Sections& sections,
+                    const TopTree& top, int levels, unsigned threadCount,
+                    bool colors) {
+    if (sections.subtreeCount() != top.keys.size()) {
+        ByteReader::fail("subtree table does not match cells");
+    }
+    std::vector<SubtreeCells> parts(top.keys.size());
+    parallelFor(parts.size(), threadCount, [&](size_t index) {
+        parts[index] = decodeSubtree(sections, top, index, levels, colors);
+    });
+    uint64_t total = 0;
+    for (const SubtreeCells& part : parts) total += part.points;
+    if (levels == sections.depth - sections.subtreeLevel &&
+        total != sections.pointCount) {
+        ByteReader::fail("point counts do not match point total");
+    }
+
+    // Each subtree's points go straight to their place in the model
+    std::vector<size_t> offsets{model.vertices.size()};
+    for (const SubtreeCells& part : parts) {
+        offsets.push_back(offsets.back() + static_cast<size_t>(part.points));
+    }
+    model.vertices.resize(offsets.back());
+    if (colors) model.colors.resize(offsets.back());
+    parallelFor(parts.size(), threadCount, [&](size_t index) {
+        placeCells(sections, top, index, levels, parts[index],
+                   model.vertices.data() + offsets[index],
+                   colors ? model.colors.data() + offsets[index] : nullptr);
+    });
+}
+
+// One point per occupied cell at level of a model decoded in full, at the
+// cell's center with the mean color of its points.
+std::unique_ptr<Model> meanPerCell(const Model& full, const Sections& sections,
+                                   int level) {
+    const Grid leaves(sections.center, sections.halfSize, sections.depth);
+    const Grid cells(sections.center, sections.halfSize, level);
+    const int shift = 3 * (sections.depth - level);
+    auto model = std::make_unique<Model>();
+    // Points come in Morton order, so each cell's points are contiguous
+    for (size_t i = 0; i < full.vertices.size();) {
+        uint64_t key = leaves.key(full.vertices[i]) >> shift;
+        glm::vec3 sum(0.0f);
+        size_t end = i;
+        for (; end < full.vertices.size() &&
+               leaves.key(full.vertices[end]) >> shift == key;
+             ++end) {
+            sum += full.colors[end];
+        }
+        model->vertices.push_back(cells.cellCenter(key));
+        model->colors.push_back(sum / static_cast<float>(end - i));
+        i = end;
+    }
+    model->calculateBounds();
+    return model;
+}
+
+// What every part of an encode shares: the clamped depth and subtree
+// level, and the point count that sets the RAHT steps.
+struct EncodeSettings {
+    glm::vec3 center;
+    float halfSize;
+    int depth;
+    int split;
+    uint64_t count;
+    PointCloudCodec::Options options;
+    bool transformColors;
+
+    EncodeSettings(const glm::vec3& center, float halfSize, int depth,
+                   const PointCloudCodec::Options& options)
+        : center(center),
+          halfSize(halfSize),
+          depth(std::min(std::max(depth, 1), kMaxMortonDepth)),
+          split(std::min(std::max(options.subtreeLevel, 1), this->depth)),
+          count(0),
+          options(options),
+          transformColors(options.colorQuality < 100) {}
+
+    int subtreeLevels() const { return depth - split; }
+    uint8_t colorMode() const {
+        return transformColors ? kColorRaht : kColorRgb8;
+    }
+    std::array<double, Raht::kChannels> steps() const {
+        return coefficientSteps(rahtStep(options.colorQuality),
+                                std::max<uint64_t>(count, 1));
+    }
+    std::array<StreamCoding, kSubtreeSections> requestedCodings() const {
+        // Neighbour contexts are only worth anything rANS coded
+        return {options.contextOccupancy ? StreamCoding::RansStatic
+                                         : options.occupancyCoding,
+                options.countCoding, options.colorCoding,
+                options.colorCoding};
+    }
+    size_t occupancyContexts() const {
+        return options.contextOccupancy ? kNeighborContexts : 1;
+    }
+};
+
+// Leaf cells of one subtree in Morton order: their keys below its root,
+// point counts, and either summed YCoCg colors, turned into means when the
+// subtree is coded, or RGB8 colors per point.
+struct SubtreeLeaves {
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> counts;
+    std::vector<double> means;
+    std::vector<uint8_t> colors;
+};
+
+// Adds a point of the subtree, coming in Morton order.
+void addLeafPoint(SubtreeLeaves& leaves, uint64_t key, const glm::vec3& color,
+                  bool transformColors) {
+    if (leaves.keys.empty() || leaves.keys.back() != key) {
+        leaves.keys.push_back(key);
+        leaves.counts.push_back(0);
+        if (transformColors) {
+            leaves.means.resize(leaves.means.size() + Raht::kChannels, 0.0);
+        }
+    }
+    ++leaves.counts.back();
+    if (transformColors) {
+        double ycocg[Raht::kChannels];
+        toYCoCg(color, ycocg);
+        double* sum = leaves.means.data() + leaves.means.size() -
+                      Raht::kChannels;
+        for (int c = 0; c < Raht::kChannels; ++c) sum[c] += ycocg[c];
+    } else {
+        leaves.colors.push_back(quantizeColor(color.x));
+        leaves.colors.push_back(quantizeColor(color.y));
+        leaves.colors.push_back(quantizeColor(color.z));
+    }
+}
+
+// Levels above the subtrees: the subtree roots, the occupancy codes and
+// their contexts per level, and the transform weight of each root, which
+// its subtree starts from.
+struct TopLevels {
+    std::vector<uint64_t> roots;
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<std::vector<uint8_t>> contexts;
+    std::vector<uint64_t> rootWeights;
+};
+
+TopLevels encodeTop(std::vector<uint64_t> roots,
+                    const EncodeSettings& settings) {
+    TopLevels top;
+    top.roots = std::move(roots);
+    std::vector<uint64_t> keys = top.roots;
+    top.codes = buildLevels(keys, settings.split);
+    top.contexts.resize(settings.split);
+    if (settings.options.contextOccupancy && !top.roots.empty()) {
+        top.contexts = occupancyContexts(top.codes);
+    }
+    top.rootWeights = {kRootWeight};
+    for (const auto& codes : top.codes) {
+        top.rootWeights = splitWeights(codes, top.rootWeights);
+    }
+    return top;
+}
+
+// A subtree coded on its own: per level, the occupancy codes, their
+// contexts when they have them and the RAHT coefficients that split the
+// level's cells; then the leaves' point counts and RGB8 colors. For RAHT
+// colors also its root's low-pass value, which the top coefficients carry.
+struct EncodedSubtree {
+    std::vector<std::vector<uint8_t>> codes;
+    std::vector<std::vector<uint8_t>> contexts;
+    std::vector<std::vector<uint8_t>> coefficients;
+    std::vector<uint8_t> counts;
+    std::vector<uint8_t> colors;
+    std::array<double, Raht::kChannels> rootMean{};
+};
+
+EncodedSubtree encodeSubtree(SubtreeLeaves& leaves, const TopLevels& top,
+                             size_t index, const EncodeSettings& settings) {
+    const int levels = settings.subtreeLevels();
+    EncodedSubtree subtree;
+    std::vector<uint64_t> keys = leaves.keys;
+    subtree.codes = buildLevels(keys, levels);
+    subtree.contexts.resize(levels);
+    if (settings.options.contextOccupancy) {
+        subtree.contexts = occupancyContexts(subtree.codes);
+    }
+
+    subtree.coefficients.resize(levels);
+    if (settings.transformColors) {
+        for (size_t i = 0; i < leaves.keys.size(); ++i) {
+            for (int c = 0; c < Raht::kChannels; ++c) {
+                leaves.means[Raht::kChannels * i + c] /=
+                    static_cast<double>(leaves.counts[i]);
+            }
+        }
+        std::vector<uint64_t> weights{top.rootWeights[index]};
+        for (const auto& level : subtree.codes) {
+            weights = splitWeights(level, weights);
+        }
+        std::vector<double> coefficients =
+            Raht::forward(leaves.keys, weights, levels, leaves.means);
+        double scale = std::sqrt(static_cast<double>(top.rootWeights[index]));
+        for (int c = 0; c < Raht::kChannels; ++c) {
+            subtree.rootMean[c] = coefficients[c] / scale;
+        }
+        // As in the top, through level l there are as many coefficients as
+        // cells at level l + 1
+        for (int level = 0; level < levels; ++level) {
+            size_t begin = subtree.codes[level].size();
+            size_t end = level + 1 < levels ? subtree.codes[level + 1].size()
+                                            : leaves.keys.size();
+            subtree.coefficients[level] =
+                encodeCoefficients(&coefficients[Raht::kChannels * begin],
+                                   end - begin, settings.steps());
+        }
+    }
+
+    ByteWriter counts(subtree.counts);
+    for (uint64_t count : leaves.counts) counts.varint(count - 1);
+    subtree.colors = std::move(leaves.colors);
+    return subtree;
+}
+
+// Histograms of a stream started from the occupancy codes of its top.
+SectionHistograms countTop(const EncodeSettings& settings,
+                           const TopLevels& top) {
+    SectionHistograms histograms =
+        makeHistograms(settings.occupancyContexts());
+    for (size_t level = 0; level < top.codes.size(); ++level) {
+        countSymbols(top.codes[level],
+                     settings.options.contextOccupancy
+                         ? top.contexts[level].data()
+                         : nullptr,
+                     histograms[kSectionOccupancy]);
+    }
+    return histograms;
+}
+
+void countSubtree(const EncodeSettings& settings,
+                  const EncodedSubtree& subtree,
+                  SectionHistograms& histograms) {
+    for (size_t level = 0; level < subtree.codes.size(); ++level) {
+        countSymbols(subtree.codes[level],
+                     settings.options.contextOccupancy
+                         ? subtree.contexts[level].data()
+                         : nullptr,
+                     histograms[kSectionOccupancy]);
+        countSymbols(subtree.coefficients[level], nullptr,
+                     histograms[kSectionCoefficients]);
+    }
+    countSymbols(subtree.counts, nullptr, histograms[kSectionCounts]);
+    countSymbols(subtree.colors, nullptr, histograms[kSectionColors]);
+}
+
+// Writes how each section but the occupancy codes is coded.
+void writeSubtreeCodings(ByteWriter& out, const SectionCodings& codings,
+                         uint8_t colorMode) {
+    for (int section = kSectionOccupancy + 1; section < kSubtreeSections;
+         ++section) {
+        if (hasSection(section, colorMode)) {
+            writeCoding(out, codings[section]);
+        }
+    }
+}
+
+// The pieces of each payload of a subtree: one per subtree level, then the
+// leaves'.
+using SubtreePieces =
+    std::array<std::vector<std::vector<uint8_t>>, kSubtreePayloads>;
+
+SubtreePieces writeSubtree(const EncodedSubtree& subtree,
+                           const SectionCodings& codings, uint8_t colorMode) {
+    const size_t levels = subtree.codes.size();
+    std::array<std::vector<std::vector<PieceSection>>, kSubtreePayloads>
+        sections;
+    for (auto& pieces : sections) pieces.resize(levels + 1);
+    for (size_t level = 0; level < levels; ++level) {
+        const std::vector<uint8_t>& contexts = subtree.contexts[level];
+        sections[kPayloadGeometry][level].push_back(
+            {kSectionOccupancy, &subtree.codes[level],
+             contexts.empty() ? nullptr : contexts.data()});
+        if (colorMode == kColorRaht) {
+            sections[kPayloadAttributes][level].push_back(
+                {kSectionCoefficients, &subtree.coefficients[level],
+                 nullptr});
+        }
+    }
+    sections[kPayloadGeometry][levels].push_back(
+        {kSectionCounts, &subtree.counts, nullptr});
+    if (colorMode == kColorRgb8) {
+        sections[kPayloadAttributes][levels].push_back(
+            {kSectionColors, &subtree.colors, nullptr});
+    }
+    SubtreePieces pieces;
+    for (int payload = 0; payload < kSubtreePayloads; ++payload) {
+        pieces[payload] =
+            writePieces(sections[payload], codings,
+                        hasStored(payload, codings, colorMode));
+    }
+    return pieces;
+}
+
+// Everything before the subtrees: the header and how occupancy codes are
+// coded, then the occupancy codes and RAHT coefficients of each level above
+// them. rootMeans holds the mean color of each subtree root.
+void writeHead(ByteWriter& out, const EncodeSettings& settings,
+               const TopLevels& top, const std::vector<double>& rootMeans,
+               const SectionCoding& occupancy) {
+    // RAHT coefficients of the top per level: level l holds those that
+    // split its cells into the cells of level l + 1, level 0 also the DC
+    // term. Through level l there are as many as cells at level l + 1.
+    const int split = settings.split;
+    std::vector<std::vector<uint8_t>> topColors(split);
+    if (settings.transformColors && !top.roots.empty()) {
+        std::vector<double> coefficients =
+            Raht::forward(top.roots, top.rootWeights, split, rootMeans);
+        for (int level = 0; level < split; ++level) {
+            size_t begin = level == 0 ? 0 : top.codes[level].size();
+            size_t end = level + 1 < split ? top.codes[level + 1].size()
+                                           : top.roots.size();
+            topColors[level] =
+                encodeCoefficients(&coefficients[Raht::kChannels * begin],
+                                   end - begin, settings.steps());
+        }
+    }
+
+    const PointCloudCodec::Options& options = settings.options;
+    out.bytes(kMagic, sizeof(kMagic));
+    out.u32(PointCloudCodec::kVersion);
+    out.u8(static_cast<uint8_t>(settings.depth));
+    out.f32(settings.center.x);
+    out.f32(settings.center.y);
+    out.f32(settings.center.z);
+    out.f32(settings.halfSize);
+    out.u64(settings.count);
+    out.u8(options.contextOccupancy ? kOccupancyByNeighbors
+                                    : kOccupancyOneTable);
+    if (settings.transformColors) {
+        out.u8(kColorRaht);
+        out.f32(rahtStep(options.colorQuality));
+    } else {
+        out.u8(kColorRgb8);
+    }
+    out.u8(static_cast<uint8_t>(split));
+    writeCoding(out, occupancy);
+    // Each level's occupancy codes in a block of their own, so that a
+    // decode can stop after any level
+    for (int level = 0; level < split; ++level) {
+        const std::vector<uint8_t>& codes = top.codes[level];
+        if (occupancy.rans && !codes.empty()) {
+            std::vector<uint8_t> block;
+            RansEncoder encoder;
+            encodeLevelCodes(encoder, codes.data(),
+                             options.contextOccupancy
+                                 ? top.contexts[level].data()
+                                 : nullptr,
+                             codes.size(), occupancy.tables);
+            encoder.finish(block);
+            out.block(block);
+        } else {
+            out.block(codes);
+        }
+        if (settings.transformColors) {
+            writeStream(out, options.colorCoding, topColors[level]);
+        }
+    }
+}
+
+// Leaf data when the cells at the subtree level are leaves: there are no
+// subtrees to write and the leaf data follows the levels in one stream
+// each.
+void writeLeaves(ByteWriter& out, const EncodeSettings& settings,
+                 const std::vector<uint8_t>& counts,
+                 const std::vector<uint8_t>& colors) {
+    writeStream(out, settings.options.countCoding, counts);
+    if (!settings.transformColors) {
+        writeStream(out, settings.options.colorCoding, colors);
+    }
+}
+
+// Encodes count points, positionAt(i) and colorAt(i) returning those of
+// point i.
+template <typename PositionAt, typename ColorAt>
+std::vector<uint8_t> encodePoints(size_t count, PositionAt&& positionAt,
+                                  ColorAt&& colorAt, const glm::vec3& center,
+                                  float halfSize, int depth,
+                                  const PointCloudCodec::Options& options) {
+    EncodeSettings settings(center, halfSize, depth, options);
+    settings.count = count;
+    const Grid grid(center, halfSize, settings.depth);
+
+    std::vector<MortonEntry> entries(count);
+    const size_t chunkSize = 1 << 16;
+    const size_t chunks = (count + chunkSize - 1) / chunkSize;
+    parallelFor(chunks, options.threadCount, [&](size_t chunk) {
+        size_t first = chunk * chunkSize;
+        size_t last = std::min(first + chunkSize, count);
+        for (size_t i = first; i < last; ++i) {
+            entries[i] = {grid.key(positionAt(i)), i};
+        }
+    });
+    radixSortMorton(entries, 3 * settings.depth);
+
+    // Subtree roots and the first point of each
+    const int shift = 3 * settings.subtreeLevels();
+    std::vector<uint64_t> roots;
+    std::vector<size_t> subtreeStarts;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || entries[i].key >> shift != roots.back()) {
+            roots.push_back(entries[i].key >> shift);
+            subtreeStarts.push_back(i);
+        }
+    }
+    subtreeStarts.push_back(count);
+    const TopLevels top = encodeTop(std::move(roots), settings);
+
+    // Subtrees write only their own slots, so the output does not depend
+    // on the thread count
+    const size_t subtreeCount = top.roots.size();
+    std::vector<EncodedSubtree> encoded(subtreeCount);
+    std::vector<double> rootMeans(Raht::kChannels * subtreeCount);
+    parallelFor(subtreeCount, options.threadCount, [&](size_t index) {
+        const uint64_t mask = (uint64_t(1) << shift) - 1;
+        SubtreeLeaves leaves;
+        for (size_t i = subtreeStarts[index]; i < subtreeStarts[index + 1];
+             ++i) {
+            addLeafPoint(leaves, entries[i].key & mask,
+                         colorAt(entries[i].index), settings.transformColors);
+        }
+        encoded[index] = encodeSubtree(leaves, top, index, settings);
+        std::copy(encoded[index].rootMean.begin(),
+                  encoded[index].rootMean.end(),
+                  rootMeans.begin() + Raht::kChannels * index);
+    });
+
+    // Leaves at the subtree level have only their counts and colors, in
+    // the leaf streams
+    SectionHistograms histograms = countTop(settings, top);
+    if (settings.split < settings.depth) {
+        for (const EncodedSubtree& subtree : encoded) {
+            countSubtree(settings, subtree, histograms);
+        }
+    }
+    const SectionCodings codings =
+        chooseCodings(histograms, settings.requestedCodings());
+    std::vector<uint8_t> stream;
+    ByteWriter out(stream);
+    writeHead(out, settings, top, rootMeans, codings[kSectionOccupancy]);
+    if (settings.split == settings.depth) {
+        std::vector<uint8_t> counts;
+        std::vector<uint8_t> colors;
+        for (const EncodedSubtree& subtree : encoded) {
+            counts.insert(counts.end(), subtree.counts.begin(),
+                          subtree.counts.end());
+            colors.insert(colors.end(), subtree.colors.begin(),
+                          subtree.colors.end());
+        }
+        writeLeaves(out, settings, counts, colors);
+        return stream;
+    }
+
+    writeSubtreeCodings(out, codings, settings.colorMode());
+    std::vector<SubtreePieces> pieces(subtreeCount);
+    parallelFor(subtreeCount, options.threadCount, [&](size_t index) {
+        pieces[index] =
+            writeSubtree(encoded[index], codings, settings.colorMode());
+    });
+    // Level by level, each after the size of every piece in it, so that a
+    // decode down to some level reads a prefix of the stream
+    for (int level = 0; level <= settings.subtreeLevels(); ++level) {
+        std::vector<uint8_t> table;
+        ByteWriter tableWriter(table);
+        for (const SubtreePieces& subtree : pieces) {
+            for (const auto& payload : subtree) {
+                tableWriter.varint(payload[level].size());
+            }
+        }
+        out.block(table);
+        for (const SubtreePieces& subtree : pieces) {
+            for (const auto& payload : subtree) out.bytes(payload[level]);
+        }
+    }
+    return stream;
+}
+
+// Saves a coded subtree besides its root mean to a spill file, each level's
+// sections, then the leaves', as a block.
+void spillSubtree(TempFile& file, const EncodedSubtree& subtree) {
+    std::vector<uint8_t> bytes;
+    ByteWriter out(bytes);
+    for (size_t level = 0; level < subtree.codes.size(); ++level) {
+        out.block(subtree.codes[level]);
+        out.block(subtree.contexts[level]);
+        out.block(subtree.coefficients[level]);
+    }
+    out.block(subtree.counts);
+    out.block(subtree.colors);
+    file.write(bytes.data(), bytes.size());
+}
+
+EncodedSubtree readSpilledSubtree(TempFile& file, int levels) {
+    auto readBlock = [&](std::vector<uint8_t>& block) {
+        uint8_t size[8];
+        file.readExact(size, sizeof(size));
+        block.resize(ByteReader(size, sizeof(size)).u64());
+        file.readExact(block.data(), block.size());
+    };
+    EncodedSubtree subtree;
+    subtree.codes.resize(levels);
+    subtree.contexts.resize(levels);
+    subtree.coefficients.resize(levels);
+    for (int level = 0; level < levels; ++level) {
+        readBlock(subtree.codes[level]);
+        readBlock(subtree.contexts[level]);
+        readBlock(subtree.coefficients[level]);
+    }
+    readBlock(subtree.counts);
+    readBlock(subtree.colors);
+    return subtree;
+}
+
+// Encodes the points of an Octree or MappedOctree over its root cube.
+template <typename Tree>
+std::vector<uint8_t> encodeTree(const Tree& tree, int depth,
+                                const PointCloudCodec::Options& options) {
+    // Pointers into the tree's buckets rather than a copy of every point.
+    // A bucket holds the colors, the VertexData payload, next to the
+    // positions.
+    std::vector<const glm::vec3*> positions;
+    std::vector<const glm::vec3*> colors;
+    positions.reserve(tree.size());
+    colors.reserve(tree.size());
+    const auto root = tree.getRootCube();
+    const glm::vec3 half(root.halfSize);
+    tree.queryBuckets(root.center - half, root.center + half,
+                      [&](const glm::vec3* items,
+                          const glm::vec3* itemPositions, size_t count,
+                          bool) {
+                          for (size_t i = 0; i < count; ++i) {
+                              positions.push_back(itemPositions + i);
+                              colors.push_back(items + i);
+                          }
+                      });
+    return encodePoints(
+        positions.size(),
+        [&](size_t i) -> const glm::vec3& { return *positions[i]; },
+        [&](size_t i) -> const glm::vec3& { return *colors[i]; },
+        root.center, root.halfSize, depth, options);
+}
+
+}  // namespace
+
+std::vector<uint8_t> PointCloudCodec::encode(const Model& model,
+                                             const glm::vec3& center,
+                                             float halfSize, int depth,
+                                             const Options& options) {
+    return encodePoints(
+        model.vertices.size(),
+        [&](size_t i) -> const glm::vec3& { return model.vertices[i]; },
+        [&](size_t i) -> const glm::vec3& { return model.colors[i]; }, center,
+        halfSize, depth, options);
+}
+
+std::vector<uint8_t> PointCloudCodec::encode(const Octree<VertexData>& tree,
+                                             int depth,
+                                             const Options& options) {
+    return encodeTree(tree, depth, options);
+}
+
+std::vector<uint8_t> PointCloudCodec::encode(
+    const MappedOctree<VertexData>& tree, int depth, const Options& options) {
+    return encodeTree(tree, depth, options);
+}
+
+struct PointCloudCodec::FileEncoder::State {
+    std::string filename;
+    std::string tempDirectory;
+    EncodeSettings settings;
+    Grid grid;
+    ExternalMortonSort sort;
+    // Subtree roots of the points pushed, sorted and deduplicated up to
+    // uniqueRoots
+    std::vector<uint64_t> roots;
+    size_t uniqueRoots;
+
+    State(const std::string& filename, const glm::vec3& center,
+          float halfSize, int depth, const Options& options,
+          size_t memoryLimit, const std::string& tempDirectory)
+        : filename(filename),
+          tempDirectory(tempDirectory),
+          settings(center, halfSize, depth, options),
+          grid(center, halfSize, settings.depth),
+          sort(3 * settings.depth, memoryLimit, tempDirectory),
+          uniqueRoots(0) {}
+
+    void compactRoots() {
+        std::sort(roots.begin(), roots.end());
+        roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+        uniqueRoots = roots.size();
+    }
+};
+
+PointCloudCodec::FileEncoder::FileEncoder(const std::string& filename,
+                                          const glm::vec3& center,
+                                          float halfSize, int depth,
+                                          const Options& options,
+                                          size_t memoryLimit,
+                                          const std::string& tempDirectory)
+    : state(std::make_unique<State>(filename, center, halfSize, depth,
+                                    options, memoryLimit, tempDirectory)) {}
+
+PointCloudCodec::FileEncoder::~FileEncoder() = default;
+
+void PointCloudCodec::FileEncoder::push(const glm::vec3* positions,
+                                        const glm::vec3* colors,
+                                        size_t count) {
+    if (!state) throw std::runtime_error("File encoder already finished");
+    State& s = *state;
+    const int shift = 3 * s.settings.subtreeLevels();
+    for (size_t i = 0; i < count; ++i) {
+        const uint64_t key = s.grid.key(positions[i]);
+        s.sort.push({key, colors[i]});
+        // Points arrive in runs of nearby ones, so most share the last root
+        if (s.roots.empty() || s.roots.back() != key >> shift) {
+            s.roots.push_back(key >> shift);
+            if (s.roots.size() >= 2 * s.uniqueRoots + 4096) s.compactRoots();
+        }
+    }
+}
+
+void PointCloudCodec::FileEncoder::push(const std::vector<glm::vec3>& positions,
+                                        const std::vector<glm::vec3>& colors) {
+    if (positions.size() != colors.size()) {
+        throw std::runtime_error("Pushed positions and colors differ in count");
+    }
+    push(positions.data(), colors.data(), positions.size());
+}
+
+void PointCloudCodec::FileEncoder::finish() {
+    if (!state) throw std::runtime_error("File encoder already finished");
+    std::unique_ptr<State> finished = std::move(state);
+    State& s = *finished;
+    EncodeSettings& settings = s.settings;
+    settings.count = s.sort.size();
+    s.compactRoots();
+    s.sort.finish();
+    const TopLevels top = encodeTop(std::move(s.roots), settings);
+
+    // One pass over the merged points codes each subtree as it completes.
+    // Coded subtrees wait in a spill file until the tables shared by all of
+    // them are known; subtrees at the grid depth are single leaves whose
+    // data goes into the leaf streams instead.
+    const bool leafStreams = settings.split == settings.depth;
+    const int shift = 3 * settings.subtreeLevels();
+    const uint64_t mask = (uint64_t(1) << shift) - 1;
+    std::vector<double> rootMeans(Raht::kChannels * top.roots.size());
+    SectionHistograms histograms = countTop(settings, top);
+    std::vector<uint8_t> leafCounts;
+    std::vector<uint8_t> leafColors;
+    TempFile spill(s.tempDirectory);
+    size_t index = 0;
+    MortonPoint point;
+    bool more = s.sort.next(point);
+    while (more) {
+        const uint64_t root = point.key >> shift;
+        SubtreeLeaves leaves;
+        do {
+            addLeafPoint(leaves, point.key & mask, point.color,
+                         settings.transformColors);
+            more = s.sort.next(point);
+        } while (more && point.key >> shift == root);
+
+        EncodedSubtree subtree = encodeSubtree(leaves, top, index, settings);
+        std::copy(subtree.rootMean.begin(), subtree.rootMean.end(),
+                  rootMeans.begin() + Raht::kChannels * index);
+        if (leafStreams) {
+            leafCounts.insert(leafCounts.end(), subtree.counts.begin(),
+                              subtree.counts.end());
+            leafColors.insert(leafColors.end(), subtree.colors.begin(),
+                              subtree.colors.end());
+        } else {
+            countSubtree(settings, subtree, histograms);
+            spillSubtree(spill, subtree);
+        }
+        ++index;
+    }
+
+    const SectionCodings codings =
+        chooseCodings(histograms, settings.requestedCodings());
+    std::vector<uint8_t> head;
+    ByteWriter out(head);
+    writeHead(out, settings, top, rootMeans, codings[kSectionOccupancy]);
+    // Each level's pieces, then the leaves', go to a file of their own
+    // besides a table of their sizes, to follow the head in level order
+    const int levels = settings.subtreeLevels();
+    const int blocks = leafStreams ? 0 : levels + 1;
+    std::vector<std::vector<uint8_t>> tables(blocks);
+    std::vector<std::unique_ptr<TempFile>> coded;
+    for (int block = 0; block < blocks; ++block) {
+        coded.push_back(std::make_unique<TempFile>(s.tempDirectory));
+    }
+    if (leafStreams) {
+        writeLeaves(out, settings, leafCounts, leafColors);
+    } else {
+        writeSubtreeCodings(out, codings, settings.colorMode());
+        spill.rewind();
+        for (size_t i = 0; i < top.roots.size(); ++i) {
+            const SubtreePieces pieces =
+                writeSubtree(readSpilledSubtree(spill, levels), codings,
+                             settings.colorMode());
+            for (int level = 0; level <= levels; ++level) {
+                ByteWriter tableWriter(tables[level]);
+                for (const auto& payload : pieces) {
+                    const std::vector<uint8_t>& piece = payload[level];
+                    tableWriter.varint(piece.size());
+                    coded[level]->write(piece.data(), piece.size());
+                }
+            }
+        }
+    }
+
+    std::ofstream file(s.filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + s.filename);
+    }
+    file.write(reinterpret_cast<const char*>(head.data()),
+               static_cast<std::streamsize>(head.size()));
+    std::vector<char> chunk(size_t(1) << 20);
+    for (int block = 0; block < blocks; ++block) {
+        std::vector<uint8_t> table;
+        ByteWriter(table).block(tables[block]);
+        file.write(reinterpret_cast<const char*>(table.data()),
+                   static_cast<std::streamsize>(table.size()));
+        coded[block]->rewind();
+        while (size_t size = coded[block]->read(chunk.data(), chunk.size())) {
+            file.write(chunk.data(), static_cast<std::streamsize>(size));
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Failed to write file: " + s.filename);
+    }
+}
+
+std::unique_ptr<Model> PointCloudCodec::decode(const uint8_t* data,
+                                               size_t size,
+                                               unsigned threadCount) {
+    return decodeLevel(data, size, kMaxMortonDepth, threadCount);
+}
+
+std::unique_ptr<Model> PointCloudCodec::decodeLevel(const uint8_t* data,
+                                                    size_t size, int level,
+                                                    unsigned threadCount) {
+    const Sections sections = readSections(data, size, level);
+    level = std::min(std::max(level, 0), sections.depth);
+    const bool full = level == sections.depth;
+    if (!full && sections.colorMode == kColorRgb8) {
+        // Per-point colors are only known at the leaves
+        return meanPerCell(*decode(data, size, threadCount), sections,
+                           level);
+    }
+
+    const int split = sections.subtreeLevel;
+    if (full && split == sections.depth) return decodeLeaves(sections);
+    const TopTree top =
+        decodeTop(sections, std::min(level, split), sections.pointCount);
+    auto model = std::make_unique<Model>();
+    if (level <= split) {
+        const Grid grid(sections.center, sections.halfSize, level);
+        for (size_t i = 0; i < top.keys.size(); ++i) {
+            model->vertices.push_back(grid.cellCenter(top.keys[i]));
+            model->colors.push_back(
+                fromYCoCg(&top.means[Raht::kChannels * i]));
+        }
+    } else {
+        decodeSubtrees(*model, sections, top, level - split, threadCount,
+                       true);
+    }
+    model->calculateBounds();
+    return model;
+}
+
+std::unique_ptr<Model> PointCloudCodec::decodePositions(
+    const uint8_t* data, size_t size, unsigned threadCount) {
+    const Sections sections = readSections(data, size, kMaxMortonDepth);
+    const int split = sections.subtreeLevel;
+    if (split == sections.depth) return decodeLeaves(sections, false);
+    const TopTree top =
+        decodeTop(sections, split, sections.pointCount, false);
+    auto model = std::make_unique<Model>();
+    decodeSubtrees(*model, sections, top, sections.depth - split,
+                   threadCount, false);
+    model->calculateBounds();
+    return model;
+}
+
+std::unique_ptr<Model> PointCloudCodec::decodeRegion(const uint8_t* data,
+                                                     size_t size,
+                                                     const glm::vec3& min,
+                                                     const glm::vec3& max,
+                                                     unsigned threadCount) {
+    const Sections sections = readSections(data, size, kMaxMortonDepth);
+    const int split = sections.subtreeLevel;
+    auto model = std::make_unique<Model>();
+    if (split == sections.depth) {
+        // Without subtrees there is nothing to skip
+        appendInBox(*model, *decodeLeaves(sections), min, max);
+        model->calculateBounds();
+        return model;
+    }
+
+    const TopTree top = decodeTop(sections, split, sections.pointCount);
+    if (sections.subtreeCount() != top.keys.size()) {
+        ByteReader::fail("subtree table does not match cells");
+    }
+    const Grid grid(sections.center, sections.halfSize, split);
+    const glm::vec3 half(0.5f * grid.cellSize);
+    std::vector<size_t> selected;
+    for (size_t index = 0; index < top.keys.size(); ++index) {
+        glm::vec3 cellCenter = grid.cellCenter(top.keys[index]);
+        glm::vec3 low = cellCenter - half;
+        glm::vec3 high = cellCenter + half;
+        if (low.x <= max.x && low.y <= max.y && low.z <= max.z &&
+            high.x >= min.x && high.y >= min.y && high.z >= min.z) {
+            selected.push_back(index);
+        }
+    }
+    const int levels = sections.depth - split;
+    std::vector<Model> parts(selected.size());
+    parallelFor(parts.size(), threadCount, [&](size_t i) {
+        const SubtreeCells cells =
+            decodeSubtree(sections, top, selected[i], levels);
+        const size_t points = static_cast<size_t>(cells.points);
+        parts[i].vertices.resize(points);
+        parts[i].colors.resize(points);
+        placeCells(sections, top, selected[i], levels, cells,
+                   parts[i].vertices.data(), parts[i].colors.data());
+    });
+    for (const Model& part : parts) appendInBox(*model, part, min, max);
+    model->calculateBounds();
+    return model;
+}
+
+size_t PointCloudCodec::levelSize(const uint8_t* data, size_t size,
+                                  int level) {
+    return readSections(data, size, level).size;
+}
+
+bool PointCloudCodec::isEncodedFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    return file.read(magic, sizeof(magic)) &&
+           std::memcmp(magic, kMagic, sizeof(magic)) == 0;
+}
+
+void PointCloudCodec::writeFile(const std::vector<uint8_t>& stream,
+                                const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    file.write(reinterpret_cast<const char*>(stream.data()),
+               static_cast<std::streamsize>(stream.size()));
+    if (!file) {
+        throw std::runtime_error("Failed to write file: " + filename);
+    }
+}
+
+std::vector<uint8_t> PointCloudCodec::readFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + filename);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+                                std::istreambuf_iterator<char>());
+}
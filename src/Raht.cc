@@ -0,0 +1,146 @@
+#include "Raht.h"
+
+#include <cmath>
+
+namespace {
+
+constexpr int kChannels = Raht::kChannels;
+
+// Weight of the low cell of each pair merged by every step, or the whole
+// weight when the cell had no partner: enough to undo the merges from the
+// root down without keeping the keys of every step.
+std::vector<std::vector<uint64_t>> mergeWeights(std::vector<uint64_t> keys,
+                                                std::vector<uint64_t> weights,
+                                                int depth) {
+    std::vector<std::vector<uint64_t>> steps(3 * depth);
+    for (int step = 0; step < 3 * depth; ++step) {
+        std::vector<uint64_t>& low = steps[step];
+        size_t cells = 0;
+        for (size_t i = 0; i < keys.size(); ++i, ++cells) {
+            uint64_t weight = weights[i];
+            low.push_back(weight);
+            if (i + 1 < keys.size() && keys[i] >> 1 == keys[i + 1] >> 1) {
+                weight += weights[++i];
+            }
+            keys[cells] = keys[i] >> 1;
+            weights[cells] = weight;
+        }
+        keys.resize(cells);
+        weights.resize(cells);
+    }
+    return steps;
+}
+
+}  // namespace
+
+std::vector<double> Raht::forward(const std::vector<uint64_t>& leafKeys,
+                                  const std::vector<uint64_t>& leafWeights,
+                                  int depth,
+                                  const std::vector<double>& attributes) {
+    std::vector<uint64_t> keys = leafKeys;
+    std::vector<uint64_t> weights = leafWeights;
+    std::vector<double> values(attributes.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        double scale = std::sqrt(static_cast<double>(weights[i]));
+        for (int c = 0; c < kChannels; ++c) {
+            values[kChannels * i + c] = scale * attributes[kChannels * i + c];
+        }
+    }
+
+    // High-pass terms per step, merged in place
+    std::vector<std::vector<double>> highs(3 * depth);
+    for (int step = 0; step < 3 * depth; ++step) {
+        size_t cells = 0;
+        for (size_t i = 0; i < keys.size(); ++i, ++cells) {
+            double* out = &values[kChannels * cells];
+            const double* first = &values[kChannels * i];
+            uint64_t weight = weights[i];
+            if (i + 1 < keys.size() && keys[i] >> 1 == keys[i + 1] >> 1) {
+                const double* second = &values[kChannels * (i + 1)];
+                uint64_t total = weight + weights[i + 1];
+                double a = std::sqrt(double(weight) / total);
+                double b = std::sqrt(double(weights[i + 1]) / total);
+                for (int c = 0; c < kChannels; ++c) {
+                    double low = a * first[c] + b * second[c];
+                    highs[step].push_back(-b * first[c] + a * second[c]);
+                    out[c] = low;
+                }
+                weight = total;
+                ++i;
+            } else {
+                for (int c = 0; c < kChannels; ++c) out[c] = first[c];
+            }
+            keys[cells] = keys[i] >> 1;
+            weights[cells] = weight;
+        }
+        keys.resize(cells);
+        weights.resize(cells);
+    }
+
+    // The DC term is what is left of the root
+    std::vector<double> coefficients(
+        values.begin(), values.begin() + (keys.empty() ? 0 : kChannels));
+    coefficients.reserve(attributes.size());
+    for (int step = 3 * depth - 1; step >= 0; --step) {
+        coefficients.insert(coefficients.end(), highs[step].begin(),
+                            highs[step].end());
+    }
+    return coefficients;
+}
+
+std::vector<double> Raht::inverse(const std::vector<uint64_t>& keys,
+                                  const std::vector<uint64_t>& leafWeights,
+                                  int depth,
+                                  const std::vector<double>& coefficients) {
+    if (keys.empty()) return {};
+    std::vector<std::vector<uint64_t>> steps =
+        mergeWeights(keys, leafWeights, depth);
+
+    uint64_t total = 0;
+    for (uint64_t weight : leafWeights) total += weight;
+    std::vector<uint64_t> weights{total};
+    std::vector<double> values(coefficients.begin(),
+                               coefficients.begin() + kChannels);
+    const double* high = coefficients.data() + kChannels;
+
+    std::vector<uint64_t> childWeights;
+    std::vector<double> childValues;
+    for (int step = 3 * depth - 1; step >= 0; --step) {
+        const std::vector<uint64_t>& low = steps[step];
+        childWeights.clear();
+        childValues.clear();
+        size_t next = 0;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            const double* value = &values[kChannels * i];
+            uint64_t weight = weights[i];
+            // Each cell came from one or two cells a step below, in order
+            uint64_t first = low[next++];
+            if (first == weight) {
+                childWeights.push_back(weight);
+                childValues.insert(childValues.end(), value,
+                                   value + kChannels);
+                continue;
+            }
+            uint64_t second = weight - first;
+            double a = std::sqrt(double(first) / weight);
+            double b = std::sqrt(double(second) / weight);
+            childWeights.push_back(first);
+            childWeights.push_back(second);
+            size_t at = childValues.size();
+            childValues.resize(at + 2 * kChannels);
+            for (int c = 0; c < kChannels; ++c) {
+                childValues[at + c] = a * value[c] - b * high[c];
+                childValues[at + kChannels + c] = b * value[c] + a * high[c];
+            }
+            high += kChannels;
+        }
+        weights.swap(childWeights);
+        values.swap(childValues);
+    }
+
+    for (size_t i = 0; i < weights.size(); ++i) {
+        double scale = 1.0 / std::sqrt(static_cast<double>(weights[i]));
+        for (int c = 0; c < kChannels; ++c) values[kChannels * i + c] *= scale;
+    }
+    return values;
+}
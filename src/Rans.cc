@@ -0,0 +1,310 @@
+#include "Rans.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <numeric>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OCTREE_RANS_AVX2 1
+#endif
+
+namespace {
+
+// Lower bound of a normalised state; states live in [kRansLow, 2^32).
+constexpr uint32_t kRansLow = 1u << 16;
+constexpr uint32_t kMaxFrequency = kRansScale - 1;
+constexpr uint32_t kSlotMask = kRansScale - 1;
+
+#ifdef OCTREE_RANS_AVX2
+// For each mask of lanes that need a word, the index of the word each of
+// those lanes takes from the next eight: lanes consume words in lane order.
+struct WordPermutations {
+    alignas(32) int32_t lanes[256][8];
+    uint8_t taken[256];
+
+    WordPermutations() {
+        for (int mask = 0; mask < 256; ++mask) {
+            int count = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                lanes[mask][lane] = (mask >> lane) & 1 ? count++ : 0;
+            }
+            taken[mask] = static_cast<uint8_t>(count);
+        }
+    }
+};
+
+const WordPermutations kWordPermutations;
+#endif
+
+}  // namespace
+
+RansTable RansTable::fromCounts(const uint32_t counts[256]) {
+    RansTable table;
+    uint64_t total = 0;
+    for (int s = 0; s < 256; ++s) total += counts[s];
+
+    if (total > 0) {
+        int32_t sum = 0;
+        for (int s = 0; s < 256; ++s) {
+            if (counts[s] == 0) continue;
+            uint64_t scaled = uint64_t(counts[s]) * kRansScale / total;
+            table.freq[s] = static_cast<uint16_t>(
+                std::min<uint64_t>(std::max<uint64_t>(scaled, 1),
+                                   kMaxFrequency));
+            sum += table.freq[s];
+        }
+
+        // Rounding up rare symbols can overshoot; take the excess from the
+        // most frequent ones. Any shortfall goes to the most frequent.
+        std::array<uint8_t, 256> order;
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return table.freq[a] > table.freq[b];
+        });
+        while (sum > int32_t(kRansScale)) {
+            for (int i = 0; i < 256 && sum > int32_t(kRansScale); ++i) {
+                if (table.freq[order[i]] > 1) {
+                    --table.freq[order[i]];
+                    --sum;
+                }
+            }
+        }
+        uint8_t top = order[0];
+        table.freq[top] = static_cast<uint16_t>(std::min<int32_t>(
+            table.freq[top] + int32_t(kRansScale) - sum, kMaxFrequency));
+    }
+
+    table.buildSlots();
+    return table;
+}
+
+void RansTable::buildSlots() {
+    slotTable.assign(kRansScale, 0);
+    uint32_t start = 0;
+    for (int s = 0; s < 256; ++s) {
+        cumulative[s] = static_cast<uint16_t>(start);
+        for (uint32_t i = 0; i < freq[s]; ++i) {
+            slotTable[start + i] = freq[s] | i << 12 | uint32_t(s) << 24;
+        }
+        start += freq[s];
+    }
+}
+
+RansContextTables::RansContextTables(std::vector<RansTable> tables)
+    : tables(std::move(tables)) {
+    slotTable.reserve(this->tables.size() * kRansScale);
+    for (const RansTable& table : this->tables) {
+        slotTable.insert(slotTable.end(), table.slots(),
+                         table.slots() + kRansScale);
+    }
+}
+
+void RansTable::write(ByteWriter& out) const {
+    uint8_t present[32] = {};
+    for (int s = 0; s < 256; ++s) {
+        if (freq[s] != 0) present[s / 8] |= uint8_t(1u << (s % 8));
+    }
+    out.bytes(present, sizeof(present));
+    for (int s = 0; s < 256; ++s) {
+        if (freq[s] != 0) out.varint(freq[s]);
+    }
+}
+
+RansTable RansTable::read(ByteReader& in) {
+    RansTable table;
+    const uint8_t* present = in.bytes(32);
+    uint32_t sum = 0;
+    for (int s = 0; s < 256; ++s) {
+        if (!((present[s / 8] >> (s % 8)) & 1)) continue;
+        uint64_t f = in.varint();
+        if (f == 0 || f > kMaxFrequency) ByteReader::fail("bad rANS table");
+        table.freq[s] = static_cast<uint16_t>(f);
+        sum += static_cast<uint32_t>(f);
+        if (sum > kRansScale) ByteReader::fail("bad rANS table");
+    }
+    table.buildSlots();
+    return table;
+}
+
+RansEncoder::RansEncoder() { std::fill(state, state + kRansLanes, kRansLow); }
+
+template <typename TableAt>
+void RansEncoder::encodeSymbols(const uint8_t* symbols, size_t count,
+                                TableAt&& tableAt) {
+    for (size_t i = count; i-- > 0;) {
+        const RansTable& table = tableAt(i);
+        uint32_t& x = state[i % kRansLanes];
+        uint32_t f = table.frequency(symbols[i]);
+        // Largest state that stays below 2^32 after coding this symbol
+        uint32_t limit = ((kRansLow >> kRansScaleBits) << 16) * f;
+        if (x >= limit) {
+            words.push_back(static_cast<uint16_t>(x));
+            x >>= 16;
+        }
+        x = ((x / f) << kRansScaleBits) + x % f + table.start(symbols[i]);
+    }
+}
+
+void RansEncoder::encodeSegment(const uint8_t* symbols, size_t count,
+                                const RansTable& table) {
+    encodeSymbols(symbols, count,
+                  [&](size_t) -> const RansTable& { return table; });
+}
+
+void RansEncoder::encodeSegment(const uint8_t* symbols,
+                                const uint8_t* contexts, size_t count,
+                                const RansContextTables& tables) {
+    encodeSymbols(symbols, count, [&](size_t i) -> const RansTable& {
+        return tables[contexts[i]];
+    });
+}
+
+void RansEncoder::finish(std::vector<uint8_t>& out) {
+    for (int lane = kRansLanes - 1; lane >= 0; --lane) {
+        words.push_back(static_cast<uint16_t>(state[lane]));
+        words.push_back(static_cast<uint16_t>(state[lane] >> 16));
+    }
+    out.reserve(out.size() + 2 * words.size());
+    for (size_t i = words.size(); i-- > 0;) {
+        out.push_back(static_cast<uint8_t>(words[i]));
+        out.push_back(static_cast<uint8_t>(words[i] >> 8));
+    }
+    words.clear();
+    std::fill(state, state + kRansLanes, kRansLow);
+}
+
+RansDecoder::RansDecoder(const uint8_t* data, size_t size)
+    : data(data), wordCount(size / 2), next(0), broken(size % 2 != 0) {
+    for (int lane = 0; lane < kRansLanes; ++lane) {
+        state[lane] = readWord() << 16;
+        state[lane] |= readWord();
+    }
+}
+
+uint32_t RansDecoder::readWord() {
+    if (next >= wordCount) {
+        broken = true;
+        return 0;
+    }
+    uint32_t word = data[2 * next] | uint32_t(data[2 * next + 1]) << 8;
+    ++next;
+    return word;
+}
+
+void RansDecoder::decodeSegment(uint8_t* out, size_t count,
+                                const RansTable& table) {
+    decodeSymbols<false>(out, nullptr, count, table.slots());
+}
+
+void RansDecoder::decodeSegment(uint8_t* out, const uint8_t* contexts,
+                                size_t count,
+                                const RansContextTables& tables) {
+    decodeSymbols<true>(out, contexts, count, tables.slots());
+}
+
+template <bool kContexts>
+void RansDecoder::decodeSymbols(uint8_t* out, const uint8_t* contexts,
+                                size_t count, const uint32_t* slotArray) {
+    size_t i = 0;
+#ifdef OCTREE_RANS_AVX2
+    const __m256i slotMask = _mm256_set1_epi32(kSlotMask);
+    const __m256i zero = _mm256_setzero_si256();
+    const int* slots = reinterpret_cast<const int*>(slotArray);
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state));
+    __m256i emptySlots = zero;
+    // Eight lanes per step while eight words remain for the refill load
+    for (; i + kRansLanes <= count && next + 8 <= wordCount; i += kRansLanes) {
+        __m256i slot = _mm256_and_si256(x, slotMask);
+        if (kContexts) {
+            __m256i context = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(contexts + i)));
+            slot = _mm256_or_si256(
+                slot, _mm256_slli_epi32(context, kRansScaleBits));
+        }
+        __m256i entry = _mm256_i32gather_epi32(slots, slot, 4);
+        __m256i f = _mm256_and_si256(entry, slotMask);
+        __m256i bias =
+            _mm256_and_si256(_mm256_srli_epi32(entry, 12), slotMask);
+        x = _mm256_add_epi32(
+            _mm256_mullo_epi32(f, _mm256_srli_epi32(x, kRansScaleBits)), bias);
+        emptySlots = _mm256_or_si256(emptySlots, _mm256_cmpeq_epi32(f, zero));
+
+        __m256i symbols = _mm256_srli_epi32(entry, 24);
+        symbols = _mm256_packus_epi32(symbols, symbols);
+        symbols = _mm256_packus_epi16(symbols, symbols);
+        uint32_t low = static_cast<uint32_t>(_mm256_extract_epi32(symbols, 0));
+        uint32_t high = static_cast<uint32_t>(_mm256_extract_epi32(symbols, 4));
+        std::memcpy(out + i, &low, 4);
+        std::memcpy(out + i + 4, &high, 4);
+
+        __m256i refill = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, 16), zero);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(refill));
+        __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(data + 2 * next)));
+        words = _mm256_permutevar8x32_epi32(
+            words, _mm256_load_si256(reinterpret_cast<const __m256i*>(
+                       kWordPermutations.lanes[mask])));
+        x = _mm256_blendv_epi8(
+            x, _mm256_or_si256(_mm256_slli_epi32(x, 16), words), refill);
+        next += kWordPermutations.taken[mask];
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(state), x);
+    if (!_mm256_testz_si256(emptySlots, emptySlots)) broken = true;
+#endif
+    decodeScalar<kContexts>(out, contexts, i, count, slotArray);
+}
+
+template <bool kContexts>
+void RansDecoder::decodeScalar(uint8_t* out, const uint8_t* contexts,
+                               size_t begin, size_t end,
+                               const uint32_t* slots) {
+    uint32_t empty = 0;
+    auto step = [&](uint32_t& x, size_t i) {
+        uint32_t slot = x & kSlotMask;
+        if (kContexts) slot |= uint32_t(contexts[i]) << kRansScaleBits;
+        uint32_t entry = slots[slot];
+        uint32_t f = entry & kSlotMask;
+        empty |= f == 0;
+        x = f * (x >> kRansScaleBits) + ((entry >> 12) & kSlotMask);
+        return static_cast<uint8_t>(entry >> 24);
+    };
+
+    // Whole groups with the lanes held in locals, so the independent
+    // dependency chains overlap
+    size_t i = begin;
+    if (i % kRansLanes == 0) {
+        uint32_t x[kRansLanes];
+        std::copy(state, state + kRansLanes, x);
+        for (; i + kRansLanes <= end && next + kRansLanes <= wordCount;
+             i += kRansLanes) {
+            for (int lane = 0; lane < kRansLanes; ++lane) {
+                out[i + lane] = step(x[lane], i + lane);
+            }
+            for (int lane = 0; lane < kRansLanes; ++lane) {
+                if (x[lane] < kRansLow) {
+                    x[lane] = x[lane] << 16 | data[2 * next] |
+                              uint32_t(data[2 * next + 1]) << 8;
+                    ++next;
+                }
+            }
+        }
+        std::copy(x, x + kRansLanes, state);
+    }
+    for (; i < end; ++i) {
+        uint32_t& x = state[i % kRansLanes];
+        out[i] = step(x, i);
+        if (x < kRansLow) x = x << 16 | readWord();
+    }
+    if (empty) broken = true;
+}
+
+bool RansDecoder::finish() const {
+    if (broken || next != wordCount) return false;
+    for (uint32_t x : state) {
+        if (x != kRansLow) return false;
+    }
+    return true;
+}
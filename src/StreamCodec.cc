@@ -0,0 +1,174 @@
+#include "StreamCodec.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "ByteStream.h"
+#include "Rans.h"
+
+namespace {
+
+// Framing shared by all codings: varint decoded size, then the payload.
+uint64_t readDecodedSize(ByteReader& in, size_t maxSize) {
+    uint64_t size = in.varint();
+    if (size > maxSize) ByteReader::fail("stream larger than expected");
+    return size;
+}
+
+class RawCodec : public StreamCodec {
+   public:
+    void encode(const uint8_t* data, size_t size,
+                std::vector<uint8_t>& out) const override {
+        ByteWriter writer(out);
+        writer.varint(size);
+        writer.bytes(data, size);
+    }
+
+    std::vector<uint8_t> decode(const uint8_t* data, size_t size,
+                                size_t maxSize) const override {
+        ByteReader in(data, size);
+        uint64_t decoded = readDecodedSize(in, maxSize);
+        if (decoded != in.remaining()) ByteReader::fail("raw size mismatch");
+        const uint8_t* bytes = in.bytes(in.remaining());
+        return std::vector<uint8_t>(bytes, bytes + decoded);
+    }
+};
+
+class StaticRansCodec : public StreamCodec {
+   public:
+    void encode(const uint8_t* data, size_t size,
+                std::vector<uint8_t>& out) const override {
+        ByteWriter writer(out);
+        writer.varint(size);
+        if (size == 0) return;
+
+        uint32_t counts[256] = {};
+        for (size_t i = 0; i < size; ++i) ++counts[data[i]];
+        RansTable table = RansTable::fromCounts(counts);
+        table.write(writer);
+
+        RansEncoder encoder;
+        encoder.encodeSegment(data, size, table);
+        encoder.finish(out);
+    }
+
+    std::vector<uint8_t> decode(const uint8_t* data, size_t size,
+                                size_t maxSize) const override {
+        ByteReader in(data, size);
+        std::vector<uint8_t> out(readDecodedSize(in, maxSize));
+        if (out.empty()) return out;
+
+        RansTable table = RansTable::read(in);
+        RansDecoder decoder(in.current(), in.remaining());
+        decoder.decodeSegment(out.data(), out.size(), table);
+        if (!decoder.finish()) ByteReader::fail("corrupt rANS stream");
+        return out;
+    }
+};
+
+// Both sides rebuild the table from the same symbol counts after every
+// segment. Segments double in length so early tables adapt quickly while
+// later rebuilds stay rare; counts are halved once they grow large so old
+// statistics fade.
+class AdaptiveRansCodec : public StreamCodec {
+   public:
+    void encode(const uint8_t* data, size_t size,
+                std::vector<uint8_t>& out) const override {
+        ByteWriter writer(out);
+        writer.varint(size);
+        if (size == 0) return;
+
+        // Tables are known front to back, but rANS codes back to front.
+        // Keep each segment's counts and rebuild its table when coding it.
+        std::vector<std::array<uint32_t, 256>> counts;
+        std::vector<size_t> starts;
+        Model model;
+        for (size_t start = 0; start < size;) {
+            size_t length = std::min(model.segmentLength(), size - start);
+            counts.push_back(model.symbolCounts());
+            starts.push_back(start);
+            model.update(data + start, length);
+            start += length;
+        }
+
+        RansEncoder encoder;
+        for (size_t i = starts.size(); i-- > 0;) {
+            size_t end = i + 1 < starts.size() ? starts[i + 1] : size;
+            encoder.encodeSegment(data + starts[i], end - starts[i],
+                                  RansTable::fromCounts(counts[i].data()));
+        }
+        encoder.finish(out);
+    }
+
+    std::vector<uint8_t> decode(const uint8_t* data, size_t size,
+                                size_t maxSize) const override {
+        ByteReader in(data, size);
+        std::vector<uint8_t> out(readDecodedSize(in, maxSize));
+        if (out.empty()) return out;
+
+        RansDecoder decoder(in.current(), in.remaining());
+        Model model;
+        for (size_t start = 0; start < out.size();) {
+            size_t length = std::min(model.segmentLength(), out.size() - start);
+            decoder.decodeSegment(out.data() + start, length, model.table());
+            model.update(out.data() + start, length);
+            start += length;
+        }
+        if (!decoder.finish()) ByteReader::fail("corrupt rANS stream");
+        return out;
+    }
+
+   private:
+    class Model {
+       public:
+        Model() : length(kFirstSegment) {
+            counts.fill(1);
+            current = RansTable::fromCounts(counts.data());
+        }
+
+        size_t segmentLength() const { return length; }
+        const RansTable& table() const { return current; }
+        const std::array<uint32_t, 256>& symbolCounts() const {
+            return counts;
+        }
+
+        void update(const uint8_t* symbols, size_t count) {
+            for (size_t i = 0; i < count; ++i) counts[symbols[i]] += 2;
+            uint64_t total = 0;
+            for (uint32_t c : counts) total += c;
+            if (total > kMaxTotal) {
+                for (uint32_t& c : counts) c = (c + 1) / 2;
+            }
+            current = RansTable::fromCounts(counts.data());
+            length = std::min(length * 2, kLastSegment);
+        }
+
+       private:
+        // Multiples of kRansLanes, as RansEncoder requires
+        static constexpr size_t kFirstSegment = 512;
+        static constexpr size_t kLastSegment = 32768;
+        static constexpr uint64_t kMaxTotal = 1 << 20;
+
+        std::array<uint32_t, 256> counts;
+        RansTable current;
+        size_t length;
+    };
+};
+
+}  // namespace
+
+const StreamCodec& StreamCodec::get(StreamCoding coding) {
+    static const RawCodec raw;
+    static const StaticRansCodec ransStatic;
+    static const AdaptiveRansCodec ransAdaptive;
+    switch (coding) {
+        case StreamCoding::Raw:
+            return raw;
+        case StreamCoding::RansStatic:
+            return ransStatic;
+        case StreamCoding::RansAdaptive:
+            return ransAdaptive;
+    }
+    throw std::runtime_error("Unknown stream coding");
+}
@@ -0,0 +1,116 @@
+#include "TempFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+
+TempFile::TempFile(const std::string& directory) : file(nullptr), written(0) {
+    std::string path = directory;
+    if (path.empty()) {
+        char tmp[MAX_PATH + 1];
+        DWORD count = ::GetTempPathA(sizeof(tmp), tmp);
+        path = count > 0 && count <= MAX_PATH ? std::string(tmp, count) : ".";
+    }
+
+    // GetTempFileName creates the file under a unique name, which is then
+    // opened again to be deleted on close
+    char name[MAX_PATH];
+    if (::GetTempFileNameA(path.c_str(), "oct", 0, name) == 0) {
+        throw std::runtime_error("Failed to create temporary file in: " +
+                                 path);
+    }
+    HANDLE handle = ::CreateFileA(
+        name, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+        nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        ::DeleteFileA(name);
+        throw std::runtime_error("Failed to create temporary file in: " +
+                                 path);
+    }
+
+    int fd = ::_open_osfhandle(reinterpret_cast<intptr_t>(handle),
+                               _O_RDWR | _O_BINARY);
+    if (fd < 0) {
+        ::CloseHandle(handle);
+        throw std::runtime_error("Failed to open temporary file");
+    }
+    file = ::_fdopen(fd, "w+b");
+    if (!file) {
+        ::_close(fd);
+        throw std::runtime_error("Failed to open temporary file");
+    }
+}
+
+#else
+
+TempFile::TempFile(const std::string& directory) : file(nullptr), written(0) {
+    std::string path = directory;
+    if (path.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        path = tmp && *tmp ? tmp : "/tmp";
+    }
+    path += "/octree-XXXXXX";
+
+    // mkstemp fills in the name in place
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = ::mkstemp(name.data());
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create temporary file in: " +
+                                 path.substr(0, path.rfind('/')));
+    }
+    ::unlink(name.data());
+
+    file = ::fdopen(fd, "w+b");
+    if (!file) {
+        ::close(fd);
+        throw std::runtime_error("Failed to open temporary file");
+    }
+}
+
+#endif
+
+TempFile::~TempFile() { std::fclose(file); }
+
+void TempFile::write(const void* data, size_t size) {
+    if (size > 0 && std::fwrite(data, 1, size, file) != size) {
+        throw std::runtime_error("Failed to write temporary file");
+    }
+    written += size;
+}
+
+void TempFile::rewind() {
+    if (std::fflush(file) != 0 || std::fseek(file, 0, SEEK_SET) != 0) {
+        throw std::runtime_error("Failed to rewind temporary file");
+    }
+}
+
+size_t TempFile::read(void* data, size_t size) {
+    size_t count = std::fread(data, 1, size, file);
+    if (count < size && std::ferror(file)) {
+        throw std::runtime_error("Failed to read temporary file");
+    }
+    return count;
+}
+
+void TempFile::readExact(void* data, size_t size) {
+    if (read(data, size) != size) {
+        throw std::runtime_error("Unexpected end of temporary file");
+    }
+}
@@ -0,0 +1,255 @@
+// Regression tests run by ctest. Each test reports the checks that fail and
+// the executable exits non-zero when any did.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <glm/glm.hpp>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "BoxFilter.h"
+#include "Model.h"
+#include "Octree.h"
+#include "PointCloudCodec.h"
+#include "VertexData.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Points on a noisy unit sphere with random colors. Every seventh point
+// repeats the one before it, so cells and leaves hold duplicates.
+std::unique_ptr<Model> makeModel(size_t count, unsigned seed) {
+    auto model = std::make_unique<Model>();
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 7 == 6) {
+            model->vertices.push_back(model->vertices.back());
+        } else {
+            glm::vec3 direction(normal(rng), normal(rng), normal(rng));
+            float length = std::max(glm::length(direction), 1e-6f);
+            model->vertices.push_back(direction / length *
+                                      (1.0f + 0.01f * normal(rng)));
+        }
+        model->colors.emplace_back(unit(rng), unit(rng), unit(rng));
+    }
+    model->calculateBounds();
+    return model;
+}
+
+using VertexOctree = Octree<VertexData>;
+
+std::unique_ptr<VertexOctree> makeTree(const Model& model) {
+    glm::vec3 center = (model.minBounds + model.maxBounds) * 0.5f;
+    glm::vec3 extent = model.maxBounds - model.minBounds;
+    float halfSize = std::max({extent.x, extent.y, extent.z}) * 0.55f;
+    return std::make_unique<VertexOctree>(center, halfSize, 8, 8);
+}
+
+std::string serialize(const VertexOctree& tree) {
+    std::ostringstream out(std::ios::binary);
+    tree.write(out);
+    return out.str();
+}
+
+// Points of a decoded model as sortable tuples, so that two decodes can be
+// compared whatever order they list the points in.
+using Point = std::tuple<float, float, float, float, float, float>;
+
+std::vector<Point> sortedPoints(const Model& model) {
+    std::vector<Point> points;
+    for (size_t i = 0; i < model.vertices.size(); ++i) {
+        const glm::vec3& p = model.vertices[i];
+        glm::vec3 c = i < model.colors.size() ? model.colors[i] : glm::vec3();
+        points.emplace_back(p.x, p.y, p.z, c.x, c.y, c.z);
+    }
+    std::sort(points.begin(), points.end());
+    return points;
+}
+
+// A saved section loads into a tree that saves the same bytes and answers
+// queries the same; cut short, it is rejected.
+void testOctreeRoundTrip() {
+    auto model = makeModel(20000, 1);
+    auto tree = makeTree(*model);
+    tree->build(model->vertices, [&](size_t i) {
+        return VertexData(model->vertices[i], model->colors[i]);
+    });
+    // Some removals, so the arena holds released runs that write() skips
+    for (size_t i = 0; i < model->vertices.size(); i += 5) {
+        tree->remove(model->vertices[i]);
+    }
+
+    const std::string bytes = serialize(*tree);
+    std::istringstream in(bytes, std::ios::binary);
+    auto loaded = VertexOctree::read(in);
+    check(serialize(*loaded) == bytes, "octree round trip changes the bytes");
+    check(loaded->getNodeCount() == tree->getNodeCount(),
+          "octree round trip changes the node count");
+    glm::vec3 min(-0.3f, -1.1f, 0.2f);
+    glm::vec3 max(0.8f, 0.4f, 1.1f);
+    check(loaded->queryCount(min, max) == tree->queryCount(min, max),
+          "loaded octree answers a box query differently");
+
+    for (size_t cut : {size_t(8), bytes.size() / 2, bytes.size() - 1}) {
+        std::istringstream truncated(bytes.substr(0, cut), std::ios::binary);
+        bool threw = false;
+        try {
+            VertexOctree::read(truncated);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        check(threw, "truncated octree section loads");
+    }
+}
+
+// Incremental, batched, bulk and parallel construction build the same tree.
+void testBuildPathsAgree() {
+    auto model = makeModel(30000, 2);
+    auto makeItem = [&](size_t i) {
+        return VertexData(model->vertices[i], model->colors[i]);
+    };
+    auto incremental = makeTree(*model);
+    for (size_t i = 0; i < model->vertices.size(); ++i) {
+        incremental->insert(makeItem(i), model->vertices[i]);
+    }
+    auto batched = makeTree(*model);
+    batched->insertBatch(model->vertices.data(), model->vertices.size(),
+                         makeItem);
+    auto bulk = makeTree(*model);
+    bulk->build(model->vertices, makeItem);
+    auto parallel = makeTree(*model);
+    parallel->build(model->vertices, makeItem, 4);
+
+    const std::string expected = serialize(*incremental);
+    check(serialize(*batched) == expected, "batched build differs");
+    check(serialize(*bulk) == expected, "bulk build differs");
+    check(serialize(*parallel) == expected, "parallel build differs");
+}
+
+// Decoding gives back every point within half a cell of where it was, and
+// re-encoding exact colors reproduces the stream.
+void testCodecRoundTrip() {
+    auto model = makeModel(20000, 3);
+    const glm::vec3 center(0.0f);
+    const float halfSize = 1.1f;
+    const int depth = 9;
+    PointCloudCodec::Options options;
+    options.colorQuality = 100;
+    auto stream =
+        PointCloudCodec::encode(*model, center, halfSize, depth, options);
+    auto decoded = PointCloudCodec::decode(stream);
+    check(decoded->vertices.size() == model->vertices.size(),
+          "codec round trip changes the point count");
+
+    const float halfCell = halfSize / float(1 << depth) * 1.001f;
+    VertexOctree tree(center, halfSize, depth, 8);
+    tree.build(model->vertices, [&](size_t i) {
+        return VertexData(model->vertices[i], model->colors[i]);
+    });
+    size_t far = 0;
+    for (const glm::vec3& p : decoded->vertices) {
+        far += tree.queryCount(p - glm::vec3(halfCell),
+                               p + glm::vec3(halfCell)) == 0;
+    }
+    check(far == 0, "decoded points lie away from every input point");
+
+    check(PointCloudCodec::encode(*decoded, center, halfSize, depth,
+                                  options) == stream,
+          "re-encoding a decoded cloud changes the stream");
+}
+
+// The stream and the decoded cloud are the same for any thread count.
+void testCodecThreadDeterminism() {
+    auto model = makeModel(30000, 4);
+    PointCloudCodec::Options options;
+    options.threadCount = 1;
+    auto expected =
+        PointCloudCodec::encode(*model, glm::vec3(0.0f), 1.1f, 10, options);
+    auto decoded = sortedPoints(*PointCloudCodec::decode(expected, 1));
+    for (unsigned threads : {2u, 4u, 0u}) {
+        options.threadCount = threads;
+        check(PointCloudCodec::encode(*model, glm::vec3(0.0f), 1.1f, 10,
+                                      options) == expected,
+              "stream depends on the encoding thread count");
+        check(sortedPoints(*PointCloudCodec::decode(expected, threads)) ==
+                  decoded,
+              "decoded cloud depends on the decoding thread count");
+    }
+}
+
+// decodeRegion returns exactly the points of the full decode in the box.
+void testDecodeRegion() {
+    auto model = makeModel(30000, 5);
+    auto stream = PointCloudCodec::encode(*model, glm::vec3(0.0f), 1.1f, 10);
+    auto full = PointCloudCodec::decode(stream);
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<float> coordinate(-1.2f, 1.2f);
+    for (int i = 0; i < 20; ++i) {
+        glm::vec3 a(coordinate(rng), coordinate(rng), coordinate(rng));
+        glm::vec3 b(coordinate(rng), coordinate(rng), coordinate(rng));
+        glm::vec3 min = glm::min(a, b);
+        glm::vec3 max = glm::max(a, b);
+
+        Model inside;
+        for (size_t j = 0; j < full->vertices.size(); ++j) {
+            if (inBox(full->vertices[j], min, max)) {
+                inside.vertices.push_back(full->vertices[j]);
+                inside.colors.push_back(full->colors[j]);
+            }
+        }
+        auto region = PointCloudCodec::decodeRegion(stream, min, max);
+        check(sortedPoints(*region) == sortedPoints(inside),
+              "decodeRegion differs from filtering the full decode");
+    }
+}
+
+// Under the default options a decode down to a middle level reads a small
+// part of the stream, and decodes the same from that prefix alone.
+void testLevelPrefix() {
+    auto model = makeModel(30000, 7);
+    auto stream = PointCloudCodec::encode(*model, glm::vec3(0.0f), 1.1f, 10);
+    const int level = 5;
+    const size_t prefix =
+        PointCloudCodec::levelSize(stream.data(), stream.size(), level);
+    check(prefix < stream.size() / 3,
+          "decoding a middle level reads most of the stream");
+    check(sortedPoints(*PointCloudCodec::decodeLevel(stream.data(), prefix,
+                                                     level)) ==
+              sortedPoints(*PointCloudCodec::decodeLevel(stream, level)),
+          "a level decodes differently from its prefix");
+}
+
+}  // namespace
+
+int main() {
+    testOctreeRoundTrip();
+    testBuildPathsAgree();
+    testCodecRoundTrip();
+    testCodecThreadDeterminism();
+    testDecodeRegion();
+    testLevelPrefix();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "all tests passed\n";
+    return EXIT_SUCCESS;
+}